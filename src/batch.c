@@ -0,0 +1,388 @@
+/*
+ * batch.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "simpleaudio.h"
+#include "batch.h"
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+/*
+ * The workers share stdout and stderr.  Each file's output is emitted in
+ * one piece while holding the "output token": a single byte passed around
+ * through a pipe.
+ */
+static int batch_token_pipe[2] = { -1, -1 };
+
+static void
+batch_output_lock()
+{
+    char token;
+    if ( batch_token_pipe[0] < 0 )
+	return;
+    while ( read(batch_token_pipe[0], &token, 1) < 0 && errno == EINTR )
+	;
+}
+
+static void
+batch_output_unlock()
+{
+    char token = 0;
+    if ( batch_token_pipe[1] < 0 )
+	return;
+    if ( write(batch_token_pipe[1], &token, 1) < 0 )
+	perror("write");
+}
+
+static int
+write_all( int fd, const char *buf, size_t nbytes )
+{
+    while ( nbytes ) {
+	ssize_t n = write(fd, buf, nbytes);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("write");
+	    return -1;
+	}
+	buf += n;
+	nbytes -= n;
+    }
+    return 0;
+}
+
+static int
+copy_fd( int out_fd, int in_fd )
+{
+    char buf[8192];
+    ssize_t n;
+    while ( (n = read(in_fd, buf, sizeof(buf))) > 0 )
+	if ( write_all(out_fd, buf, n) < 0 )
+	    return -1;
+    return n < 0 ? -1 : 0;
+}
+
+
+static const char *
+batch_basename( const char *path )
+{
+    const char *base = strrchr(path, '/');
+    return base ? base+1 : path;
+}
+
+
+static int
+batch_receive_file( const receiver_config *cfg, const char *path,
+	const char *output_dir, char *app_name )
+{
+    int ret = 0;
+
+    char *report_buf = NULL;
+    size_t report_len = 0;
+    FILE *report_fp = open_memstream(&report_buf, &report_len);
+    if ( !report_fp ) {
+	perror("open_memstream");
+	return -1;
+    }
+
+    /* decoded data goes to a tmpfile (for a stdout record) or output_dir */
+    FILE *out_tmp = NULL;
+    int out_fd = -1;
+    if ( output_dir ) {
+	const char *base = batch_basename(path);
+	size_t len = strlen(output_dir) + strlen(base) + 6;
+	char *out_path = malloc(len);
+	if ( !out_path ) {
+	    perror("malloc");
+	    fclose(report_fp);
+	    free(report_buf);
+	    return -1;
+	}
+	snprintf(out_path, len, "%s/%s.txt", output_dir, base);
+	out_fd = open(out_path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if ( out_fd < 0 )
+	    fprintf(report_fp, "E: %s: %s\n", out_path, strerror(errno));
+	free(out_path);
+    } else {
+	out_tmp = tmpfile();
+	if ( out_tmp )
+	    out_fd = fileno(out_tmp);
+	else
+	    fprintf(report_fp, "E: tmpfile: %s\n", strerror(errno));
+    }
+
+    simpleaudio *sa = NULL;
+    if ( out_fd >= 0 ) {
+	sa = simpleaudio_open_stream(SA_BACKEND_MMAP, path, SA_STREAM_RECORD,
+				SA_SAMPLE_FORMAT_FLOAT, 48000, 1,
+				app_name, (char *)path);
+	if ( !sa )
+	    sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL, SA_STREAM_RECORD,
+				SA_SAMPLE_FORMAT_FLOAT, 48000, 1,
+				app_name, (char *)path);
+    }
+    if ( sa ) {
+	unsigned int sample_rate = simpleaudio_get_rate(sa);
+	fsk_plan *fskp = fsk_plan_cache_get(sample_rate,
+				cfg->mark_f, cfg->space_f, cfg->band_width);
+	receiver *rx = NULL;
+	if ( fskp )
+	    rx = receiver_new(cfg, fskp, sample_rate, out_fd, report_fp);
+	else
+	    fprintf(report_fp, "fsk_plan_new() failed\n");
+	if ( rx ) {
+	    receiver_set_stream_name(rx, path);
+	    ret = receiver_read_audio(rx, sa, NULL);
+	    receiver_destroy(rx);
+	} else {
+	    ret = -1;
+	}
+	simpleaudio_close(sa);
+    } else {
+	ret = -1;
+    }
+
+    fclose(report_fp);
+
+    /*
+     * Emit the record for this file
+     */
+    off_t ndata = 0;
+    if ( out_tmp ) {
+	ndata = lseek(out_fd, 0, SEEK_END);
+	lseek(out_fd, 0, SEEK_SET);
+	if ( ndata < 0 )
+	    ndata = 0;
+    }
+
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), " ndata=%lld status=%s\n",
+		(long long)ndata, ret ? "error" : "ok");
+
+    batch_output_lock();
+    if ( report_len ) {
+	write_all(2, "### FILE ", 9);
+	write_all(2, path, strlen(path));
+	write_all(2, "\n", 1);
+	write_all(2, report_buf, report_len);
+    }
+    if ( !output_dir ) {
+	write_all(1, "### FILE ", 9);
+	write_all(1, path, strlen(path));
+	write_all(1, header, header_len);
+	if ( ndata )
+	    copy_fd(1, out_fd);
+	write_all(1, "\n", 1);
+    }
+    batch_output_unlock();
+
+    free(report_buf);
+    if ( out_tmp )
+	fclose(out_tmp);
+    else if ( out_fd >= 0 )
+	close(out_fd);
+
+    return ret;
+}
+
+
+/*
+ * Worker: take the next unclaimed file index from the shared counter
+ * until there are none left.  Returns the number of files which failed.
+ */
+static unsigned int
+batch_worker( const receiver_config *cfg, char **paths, unsigned int npaths,
+	unsigned int *next_path, const char *output_dir, char *app_name )
+{
+    unsigned int nfailed = 0;
+    while ( 1 ) {
+	unsigned int i = __sync_fetch_and_add(next_path, 1);
+	if ( i >= npaths )
+	    break;
+	if ( batch_receive_file(cfg, paths[i], output_dir, app_name) )
+	    nfailed++;
+    }
+    fsk_plan_cache_flush();
+    return nfailed;
+}
+
+
+static unsigned int
+batch_read_manifest( FILE *fp, char ***pathsp )
+{
+    char **paths = NULL;
+    unsigned int npaths = 0, nalloc = 0;
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len;
+
+    while ( (len = getline(&line, &linesize, fp)) >= 0 ) {
+	while ( len && (line[len-1] == '\n' || line[len-1] == '\r') )
+	    line[--len] = 0;
+	if ( len == 0 )
+	    continue;
+	if ( npaths == nalloc ) {
+	    nalloc = nalloc ? nalloc * 2 : 256;
+	    paths = realloc(paths, nalloc * sizeof(char *));
+	    if ( !paths ) {
+		perror("malloc");
+		exit(1);
+	    }
+	}
+	paths[npaths] = strdup(line);
+	if ( !paths[npaths] ) {
+	    perror("malloc");
+	    exit(1);
+	}
+	npaths++;
+    }
+    free(line);
+
+    *pathsp = paths;
+    return npaths;
+}
+
+
+static int
+batch_compare_basenames( const void *a, const void *b )
+{
+    return strcmp(batch_basename(*(char * const *)a),
+		batch_basename(*(char * const *)b));
+}
+
+/*
+ * With an output_dir, files of the same basename would write the same
+ * output file: refuse to start rather than lose one of their results.
+ */
+static int
+batch_check_output_names( char **paths, unsigned int npaths,
+	const char *output_dir )
+{
+    char **sorted = malloc(npaths * sizeof(char *));
+    if ( !sorted ) {
+	perror("malloc");
+	return -1;
+    }
+    memcpy(sorted, paths, npaths * sizeof(char *));
+    qsort(sorted, npaths, sizeof(char *), batch_compare_basenames);
+
+    int ret = 0;
+    unsigned int i;
+    for ( i=1; i<npaths; i++ ) {
+	if ( batch_compare_basenames(&sorted[i-1], &sorted[i]) != 0 )
+	    continue;
+	fprintf(stderr, "E: --batch-output: %s and %s would both write %s/%s.txt\n",
+		sorted[i-1], sorted[i], output_dir, batch_basename(sorted[i]));
+	ret = -1;
+    }
+    free(sorted);
+    return ret;
+}
+
+
+int
+batch_receive( const receiver_config *cfg, char **paths, unsigned int npaths,
+	unsigned int njobs, const char *output_dir, char *app_name )
+{
+    if ( npaths == 0 )
+	npaths = batch_read_manifest(stdin, &paths);
+    if ( npaths == 0 )
+	return 0;
+
+    if ( output_dir && batch_check_output_names(paths, npaths, output_dir) )
+	return 1;
+
+    if ( njobs < 1 )
+	njobs = 1;
+    if ( njobs > npaths )
+	njobs = npaths;
+
+    unsigned int *next_path = mmap(NULL, sizeof(unsigned int),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if ( next_path == MAP_FAILED ) {
+	perror("mmap");
+	return 1;
+    }
+    *next_path = 0;
+
+    if ( njobs == 1 ) {
+	unsigned int nfailed = batch_worker(cfg, paths, npaths, next_path,
+						output_dir, app_name);
+	munmap(next_path, sizeof(unsigned int));
+	return nfailed ? 1 : 0;
+    }
+
+    if ( pipe(batch_token_pipe) < 0 ) {
+	perror("pipe");
+	return 1;
+    }
+    batch_output_unlock();	// the token starts out available
+
+    fflush(stdout);
+    fflush(stderr);
+
+    unsigned int j, nstarted = 0;
+    for ( j=0; j<njobs; j++ ) {
+	pid_t pid = fork();
+	if ( pid < 0 ) {
+	    perror("fork");
+	    break;
+	}
+	if ( pid == 0 ) {
+	    unsigned int nfailed = batch_worker(cfg, paths, npaths, next_path,
+						output_dir, app_name);
+	    _exit(nfailed ? 1 : 0);
+	}
+	nstarted++;
+    }
+
+    int ret = nstarted ? 0 : 1;
+    int status;
+    while ( nstarted ) {
+	pid_t pid = wait(&status);
+	if ( pid < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("wait");
+	    ret = 1;
+	    break;
+	}
+	if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+	    ret = 1;
+	nstarted--;
+    }
+
+    close(batch_token_pipe[0]);
+    close(batch_token_pipe[1]);
+    munmap(next_path, sizeof(unsigned int));
+
+    return ret;
+}
@@ -0,0 +1,42 @@
+/*
+ * batch.h
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "receiver.h"
+
+/*
+ * Decode many input files in one run (--batch).  If npaths is 0, the list
+ * of files is read from stdin, one path per line.  Files are shared out to
+ * njobs worker processes; each worker reuses its fsk plans across files.
+ *
+ * If output_dir is NULL, each file's decoded data is written to stdout as
+ * a record:  "### FILE {path} ndata={n} status={ok|error}\n", followed by
+ * n bytes of data and a "\n".  Otherwise it is written to the file
+ * {output_dir}/{basename}.txt, and it is an error (caught before anything
+ * is decoded) for two of the files to share a basename.
+ *
+ * Returns 0 if every file was decoded without error.
+ */
+int
+batch_receive( const receiver_config *cfg, char **paths, unsigned int npaths,
+	unsigned int njobs, const char *output_dir, char *app_name );
+
+#endif
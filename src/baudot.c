@@ -193,8 +193,10 @@ baudot_encode_table[0x60][2] = {
  * 0 unknown state
  * 1 LTRS state
  * 2 FIGS state
+ *
+ * (TX state; each RX stream keeps its own, see baudot_decode())
  */
-static unsigned int baudot_charset = 0;		// FIXME
+static unsigned int baudot_charset = 0;
 
 /*
  * UnShift on space
@@ -203,9 +205,9 @@ unsigned int baudot_usos = 1;
 
 
 void
-baudot_reset()
+baudot_reset( unsigned int *charsetp )
 {
-    baudot_charset = 1;
+    *charsetp = 1;
 }
 
 
@@ -215,24 +217,24 @@ baudot_reset()
  * the count of characters decoded and stuffed).
  */
 int
-baudot_decode( char *char_outp, unsigned char databits )
+baudot_decode( unsigned int *charsetp, char *char_outp, unsigned char databits )
 {
     /* Baudot (RTTY) */
     assert( (databits & ~0x1F) == 0 );
 
     int stuff_char = 1;
     if ( databits == BAUDOT_FIGS ) {
-	baudot_charset = 2;
+	*charsetp = 2;
 	stuff_char = 0;
     } else if ( databits == BAUDOT_LTRS ) {
-	baudot_charset = 1;
+	*charsetp = 1;
 	stuff_char = 0;
     } else if ( databits == BAUDOT_SPACE && baudot_usos ) {	/* RX un-shift on space */
-	baudot_charset = 1;
+	*charsetp = 1;
     }
     if ( stuff_char ) {
 	int t;
-	if ( baudot_charset == 1 )
+	if ( *charsetp == 1 )
 	    t = 0;
 	else
 	    t = 1;	// U.S. figs
@@ -20,7 +20,7 @@
 extern int baudot_usos;
 
 void
-baudot_reset();
+baudot_reset( unsigned int *charsetp );
 
 /*
  * Returns 1 if *char_outp was stuffed with an output character
@@ -28,7 +28,7 @@ baudot_reset();
  * the count of characters decoded and stuffed).
  */
 int
-baudot_decode( char *char_outp, unsigned char databits );
+baudot_decode( unsigned int *charsetp, char *char_outp, unsigned char databits );
 
 /*
  * Returns the number of 5-bit datawords stuffed into *databits_outp (1 or 2)
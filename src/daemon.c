@@ -0,0 +1,525 @@
+/*
+ * daemon.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+#define DAEMON_HEADER_MAX_ARGS	64
+
+// drop a client which lets this much of our output pile up unread
+#define DAEMON_OUTQ_MAX		(1 << 20)
+
+
+struct daemon_buf {
+	char		*p;
+	size_t		len;
+	size_t		size;
+};
+
+struct daemon_conn {
+	int		fd;
+	receiver	*rx;		// NULL until the header is in
+	simpleaudio	*sa;		// ... and the samples, as a raw stream
+	fsk_plan	*fskp;
+	int		fskp_private;
+
+	char		header[8192];
+	size_t		header_len;
+
+	struct daemon_buf data;		// decoded data not yet in a record
+	struct daemon_buf outq;		// records not yet sent to the client
+	int		closing;	// input is done; close once outq drains
+	int		failed;
+};
+
+
+static void
+daemon_buf_append( struct daemon_conn *c, struct daemon_buf *b,
+	const char *p, size_t nbytes )
+{
+    if ( b->len + nbytes > b->size ) {
+	size_t size = b->size ? b->size : 256;
+	while ( size < b->len + nbytes )
+	    size *= 2;
+	char *np = realloc(b->p, size);
+	if ( !np ) {
+	    perror("malloc");
+	    c->failed = 1;
+	    return;
+	}
+	b->p = np;
+	b->size = size;
+    }
+    memcpy(b->p + b->len, p, nbytes);
+    b->len += nbytes;
+}
+
+static void
+daemon_conn_record( struct daemon_conn *c, const char *type,
+	const char *buf, size_t nbytes )
+{
+    char header[32];
+    int n = snprintf(header, sizeof(header), "%s %zu\n", type, nbytes);
+    daemon_buf_append(c, &c->outq, header, n);
+    daemon_buf_append(c, &c->outq, buf, nbytes);
+    if ( c->outq.len > DAEMON_OUTQ_MAX )
+	c->failed = 1;
+}
+
+static void
+daemon_conn_flush( struct daemon_conn *c )
+{
+    if ( !c->data.len )
+	return;
+    daemon_conn_record(c, "DATA", c->data.p, c->data.len);
+    c->data.len = 0;
+}
+
+/* write as much of outq as the socket will take without blocking */
+static void
+daemon_conn_send( struct daemon_conn *c )
+{
+    size_t sent = 0;
+    while ( sent < c->outq.len ) {
+	ssize_t n = write(c->fd, c->outq.p + sent, c->outq.len - sent);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    if ( errno != EAGAIN && errno != EWOULDBLOCK )
+		c->failed = 1;
+	    break;
+	}
+	sent += n;
+    }
+    c->outq.len -= sent;
+    memmove(c->outq.p, c->outq.p + sent, c->outq.len);
+}
+
+/* receiver_output_fn: batch up decoded data, queue reports right away */
+static void
+daemon_conn_output( void *arg, int is_report, const char *buf, size_t nbytes )
+{
+    struct daemon_conn *c = arg;
+
+    if ( is_report ) {
+	daemon_conn_flush(c);
+	daemon_conn_record(c, "EVENT", buf, nbytes);
+    } else {
+	daemon_buf_append(c, &c->data, buf, nbytes);
+    }
+}
+
+static void
+daemon_conn_error( struct daemon_conn *c, const char *msg )
+{
+    daemon_conn_record(c, "ERROR", msg, strlen(msg));
+}
+
+
+static int
+daemon_conn_start( struct daemon_conn *c, char *header,
+	daemon_header_parser *parse_header )
+{
+    char *argv[DAEMON_HEADER_MAX_ARGS+1];
+    int argc = 0;
+
+    argv[argc++] = "minimodem";
+    char *tok;
+    for ( tok=strtok(header, " \t\r"); tok; tok=strtok(NULL, " \t\r") ) {
+	if ( argc == DAEMON_HEADER_MAX_ARGS ) {
+	    daemon_conn_error(c, "too many header arguments\n");
+	    return -1;
+	}
+	argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+
+    receiver_config cfg;
+    unsigned int sample_rate;
+    sa_format_t sample_format;
+    if ( parse_header(argc, argv, &cfg, &sample_rate, &sample_format) ) {
+	daemon_conn_error(c, "bad header\n");
+	return -1;
+    }
+
+    // --auto-carrier moves the plan's tones, so it cannot share a plan
+    if ( cfg.carrier_autodetect_threshold > 0.0f ) {
+	c->fskp = fsk_plan_new(sample_rate, cfg.mark_f, cfg.space_f,
+				cfg.band_width);
+	c->fskp_private = 1;
+    } else {
+	c->fskp = fsk_plan_cache_get(sample_rate, cfg.mark_f, cfg.space_f,
+				cfg.band_width);
+    }
+    if ( !c->fskp ) {
+	daemon_conn_error(c, "fsk_plan_new() failed\n");
+	return -1;
+    }
+
+    c->rx = receiver_new(&cfg, c->fskp, sample_rate, -1, NULL);
+    if ( !c->rx ) {
+	daemon_conn_error(c, "receiver_new() failed\n");
+	return -1;
+    }
+    receiver_set_output(c->rx, daemon_conn_output, c);
+
+    // name the connection in any --events-fd stream: {worker pid}.{n}
+    static unsigned int nconns;
+    char name[32];
+    snprintf(name, sizeof(name), "%d.%u", (int)getpid(), ++nconns);
+    receiver_set_stream_name(c->rx, name);
+
+    // the rest of the connection's input is samples, read without blocking
+    char device[32];
+    snprintf(device, sizeof(device), "%s:fd:%d",
+	    sample_format == SA_SAMPLE_FORMAT_FLOAT ? "float" : "s16", c->fd);
+    c->sa = simpleaudio_open_stream(SA_BACKEND_RAW, device, SA_STREAM_RECORD,
+				SA_SAMPLE_FORMAT_FLOAT, sample_rate, 1,
+				"minimodem", name);
+    if ( !c->sa || simpleaudio_set_nonblock(c->sa, 1) < 0 ) {
+	daemon_conn_error(c, "cannot open the sample stream\n");
+	return -1;
+    }
+    return 0;
+}
+
+static void
+daemon_conn_close( struct daemon_conn *c )
+{
+    if ( c->sa )
+	simpleaudio_close(c->sa);
+    if ( c->rx )
+	receiver_destroy(c->rx);
+    if ( c->fskp_private )
+	fsk_plan_destroy(c->fskp);
+    close(c->fd);
+    free(c->data.p);
+    free(c->outq.p);
+    free(c);
+}
+
+
+/*
+ * Read the connection's header line, a byte short of any samples after it
+ * (which are left for its simpleaudio stream), and start the receiver.
+ */
+static void
+daemon_conn_header( struct daemon_conn *c, daemon_header_parser *parse_header )
+{
+    char *p = c->header + c->header_len;
+    size_t space = sizeof(c->header) - 1 - c->header_len;
+    ssize_t n = recv(c->fd, p, space, MSG_PEEK);
+    if ( n > 0 ) {
+	char *nl = memchr(p, '\n', n);
+	if ( nl )
+	    n = nl + 1 - p;
+	n = read(c->fd, p, n);
+    }
+    if ( n < 0 ) {
+	if ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK )
+	    c->failed = 1;
+	return;
+    }
+    if ( n == 0 ) {
+	c->closing = 1;
+	return;
+    }
+    c->header_len += n;
+
+    if ( c->header[c->header_len-1] != '\n' ) {
+	if ( c->header_len < sizeof(c->header) - 1 )
+	    return;
+	daemon_conn_error(c, "header too long\n");
+	c->closing = 1;
+	return;
+    }
+    c->header[c->header_len-1] = 0;
+    if ( daemon_conn_start(c, c->header, parse_header) < 0 )
+	c->closing = 1;
+}
+
+/*
+ * Read what samples are ready straight into the receiver; at end of input
+ * (or on error) the connection is marked closing.
+ */
+static void
+daemon_conn_input( struct daemon_conn *c )
+{
+    size_t nsamples;
+    float *samples = receiver_get_read_buffer(c->rx, &nsamples);
+    ssize_t n = simpleaudio_read(c->sa, samples, nsamples);
+    if ( n < 0 ) {
+	if ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK )
+	    c->failed = 1;
+	return;
+    }
+    if ( n == 0 || receiver_commit_read(c->rx, n) ) {
+	receiver_finish(c->rx);	// (or --rx-one)
+	c->closing = 1;
+    }
+    daemon_conn_flush(c);
+}
+
+
+/*
+ * Worker: accept connections from the shared listening socket and
+ * multiplex them all with poll(): each connection's socket, for its header
+ * and our output, and its simpleaudio stream's descriptors, for samples.
+ * Nothing here blocks, so one slow client cannot stall the others.
+ */
+static void
+daemon_worker( int listen_fd, daemon_header_parser *parse_header )
+{
+    struct daemon_conn **conns = NULL;
+    unsigned int nconns = 0, nalloc = 0;
+    struct pollfd *pfds = NULL;
+    unsigned int *pfd_index = NULL;	// each connection's first pollfd
+    unsigned int npfds_alloc = 0;
+
+    while ( 1 ) {
+	if ( nconns + 1 > nalloc ) {
+	    nalloc = nalloc ? nalloc * 2 : 64;
+	    conns = realloc(conns, nalloc * sizeof(*conns));
+	    pfd_index = realloc(pfd_index, nalloc * sizeof(*pfd_index));
+	    if ( !conns || !pfd_index ) {
+		perror("malloc");
+		_exit(1);
+	    }
+	}
+
+	unsigned int i, npfds = 1;
+	for ( i=0; i<nconns; i++ ) {
+	    struct daemon_conn *c = conns[i];
+	    pfd_index[i] = npfds++;
+	    if ( c->sa && !c->closing )
+		npfds += simpleaudio_poll_descriptors(c->sa, NULL, 0);
+	}
+	if ( npfds > npfds_alloc ) {
+	    npfds_alloc = npfds * 2;
+	    pfds = realloc(pfds, npfds_alloc * sizeof(*pfds));
+	    if ( !pfds ) {
+		perror("malloc");
+		_exit(1);
+	    }
+	}
+
+	pfds[0].fd = listen_fd;
+	pfds[0].events = POLLIN;
+	for ( i=0; i<nconns; i++ ) {
+	    struct daemon_conn *c = conns[i];
+	    struct pollfd *pfd = pfds + pfd_index[i];
+	    pfd->fd = c->fd;
+	    pfd->events = c->closing || c->sa ? 0 : POLLIN;
+	    if ( c->outq.len )
+		pfd->events |= POLLOUT;
+	    if ( c->sa && !c->closing )
+		simpleaudio_poll_descriptors(c->sa, pfd + 1,
+				npfds - pfd_index[i] - 1);
+	}
+
+	if ( poll(pfds, npfds, -1) < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("poll");
+	    _exit(1);
+	}
+
+	// service existing connections, dropping the finished ones
+	unsigned int j = 0;
+	for ( i=0; i<nconns; i++ ) {
+	    struct daemon_conn *c = conns[i];
+	    struct pollfd *pfd = pfds + pfd_index[i];
+	    unsigned int nsa_pfds = (i+1 < nconns ? pfd_index[i+1] : npfds)
+					- pfd_index[i] - 1;
+	    short revents = pfd->revents;
+	    if ( !c->closing && c->sa && nsa_pfds
+		    && simpleaudio_poll_ready(c->sa, pfd + 1, nsa_pfds) )
+		daemon_conn_input(c);
+	    else if ( !c->closing && !c->sa
+		    && (revents & (POLLIN|POLLHUP|POLLERR)) )
+		daemon_conn_header(c, parse_header);
+	    else if ( revents & (POLLHUP|POLLERR) )
+		c->failed = 1;
+	    if ( c->outq.len && !c->failed )
+		daemon_conn_send(c);
+	    if ( c->failed || (c->closing && !c->outq.len) ) {
+		daemon_conn_close(c);
+		continue;
+	    }
+	    conns[j++] = c;
+	}
+	nconns = j;
+
+	if ( pfds[0].revents & POLLIN ) {
+	    int fd = accept(listen_fd, NULL, NULL);
+	    if ( fd < 0 )
+		continue;	// another worker got it first
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	    struct daemon_conn *c = calloc(1, sizeof(*c));
+	    if ( !c ) {
+		perror("malloc");
+		close(fd);
+		continue;
+	    }
+	    c->fd = fd;
+	    conns[nconns++] = c;
+	}
+    }
+}
+
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void
+daemon_stop_sighandler( int sig )
+{
+    daemon_stop = 1;
+}
+
+static pid_t
+daemon_spawn_worker( int listen_fd, daemon_header_parser *parse_header )
+{
+    pid_t pid = fork();
+    if ( pid < 0 ) {
+	perror("fork");
+	return -1;
+    }
+    if ( pid == 0 ) {
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	daemon_worker(listen_fd, parse_header);
+	_exit(0);
+    }
+    return pid;
+}
+
+
+int
+daemon_serve( const char *socket_path, unsigned int njobs,
+	daemon_header_parser *parse_header )
+{
+    struct sockaddr_un addr;
+    if ( strlen(socket_path) >= sizeof(addr.sun_path) ) {
+	fprintf(stderr, "E: --daemon socket path is too long: %s\n", socket_path);
+	return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( listen_fd < 0 ) {
+	perror("socket");
+	return 1;
+    }
+
+    // replace a stale socket left behind by an earlier run
+    struct stat st;
+    if ( stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode) )
+	unlink(socket_path);
+
+    if ( bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(listen_fd, SOMAXCONN) < 0 ) {
+	fprintf(stderr, "E: %s: %s\n", socket_path, strerror(errno));
+	close(listen_fd);
+	return 1;
+    }
+    // all of the workers poll() the listening socket; losers must not block
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_stop_sighandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);	// no SA_RESTART: interrupt wait()
+    sigaction(SIGTERM, &sa, NULL);
+
+    if ( njobs < 1 )
+	njobs = 1;
+    pid_t *pids = calloc(njobs, sizeof(pid_t));
+    if ( !pids ) {
+	perror("malloc");
+	close(listen_fd);
+	return 1;
+    }
+
+    int ret = 0;
+    unsigned int j;
+    for ( j=0; j<njobs; j++ ) {
+	pids[j] = daemon_spawn_worker(listen_fd, parse_header);
+	if ( pids[j] < 0 ) {
+	    daemon_stop = 1;
+	    ret = 1;
+	    break;
+	}
+    }
+
+    // restart any worker which dies, until we are told to stop
+    while ( !daemon_stop ) {
+	int status;
+	pid_t pid = wait(&status);
+	if ( pid < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("wait");
+	    ret = 1;
+	    break;
+	}
+	for ( j=0; j<njobs; j++ )
+	    if ( pids[j] == pid )
+		break;
+	if ( j == njobs || daemon_stop )
+	    continue;
+	fprintf(stderr, "W: daemon worker %d exited (status 0x%x), restarting\n",
+		(int)pid, status);
+	sleep(1);
+	pids[j] = daemon_spawn_worker(listen_fd, parse_header);
+	if ( pids[j] < 0 ) {
+	    ret = 1;
+	    break;
+	}
+    }
+
+    for ( j=0; j<njobs; j++ )
+	if ( pids[j] > 0 )
+	    kill(pids[j], SIGTERM);
+    while ( wait(NULL) > 0 || errno == EINTR )
+	;
+
+    free(pids);
+    close(listen_fd);
+    unlink(socket_path);
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+/*
+ * daemon.h
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "simpleaudio.h"
+#include "receiver.h"
+
+/*
+ * Turns a connection header, split into an argv (argv[0] is a placeholder
+ * program name), into a receiver_config and the stream's sample rate and
+ * sample format.  Returns 0 on success.
+ */
+typedef int (daemon_header_parser)( int argc, char **argv,
+	receiver_config *cfg, unsigned int *sample_ratep,
+	sa_format_t *sample_formatp );
+
+/*
+ * Serve decode requests on the Unix domain socket socket_path (--daemon),
+ * with a fixed pool of njobs worker processes.  Each worker multiplexes
+ * any number of connections.
+ *
+ * A client sends one header line of receive options and {baudmode}, as
+ * on the command line (e.g. "-R 8000 1200\n"), followed by raw mono
+ * native-endian PCM: S16, or float with --float-samples.  The daemon
+ * replies with records "DATA {n}\n" or "EVENT {n}\n" (CARRIER/NOCARRIER
+ * reports), each followed by n bytes, or "ERROR {n}\n" if the header is
+ * rejected.
+ *
+ * Runs until SIGINT or SIGTERM; returns the exit status.
+ */
+int
+daemon_serve( const char *socket_path, unsigned int njobs,
+	daemon_header_parser *parse_header );
+
+#endif
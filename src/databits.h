@@ -17,6 +17,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef DATABITS_H
+#define DATABITS_H
+
 // Reverses the ordering of the bits on an integer
 static inline unsigned long long
 bit_reverse(unsigned long long value,
@@ -48,7 +51,21 @@ bit_window(unsigned long long value,
 typedef int (databits_encoder)(
 	unsigned int *databits_outp, char char_out );
 
-typedef unsigned int (databits_decoder)(
+/*
+ * Decoder state carried from one frame to the next (Baudot shift state,
+ * Caller-ID message assembly) lives in a databits_state owned by the
+ * caller, one per input stream.  Zero it before first use.
+ */
+typedef struct databits_state databits_state;
+
+struct databits_state {
+	unsigned int	baudot_charset;
+	int		cid_msgtype;
+	int		cid_ndata;
+	unsigned char	cid_buf[256];
+};
+
+typedef unsigned int (databits_decoder)( databits_state *state,
 	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
@@ -57,7 +74,8 @@ int
 databits_encode_ascii8( unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_ascii8( char *dataout_p, unsigned int dataout_size,
+databits_decode_ascii8( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
@@ -67,7 +85,8 @@ databits_decode_ascii8( char *dataout_p, unsigned int dataout_size,
 //databits_encode_baudot( unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_baudot( char *dataout_p, unsigned int dataout_size,
+databits_decode_baudot( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
@@ -75,18 +94,24 @@ int
 databits_encode_binary( unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_binary( char *dataout_p, unsigned int dataout_size,
+databits_decode_binary( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
 unsigned int
-databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
+databits_decode_callerid( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 unsigned int
-databits_decode_uic_ground( char *dataout_p, unsigned int dataout_size,
+databits_decode_uic_ground( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 unsigned int
-databits_decode_uic_train( char *dataout_p, unsigned int dataout_size,
+databits_decode_uic_train( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
+
+#endif
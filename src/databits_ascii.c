@@ -33,7 +33,8 @@ databits_encode_ascii8( unsigned int *databits_outp, char char_out )
 
 /* returns nbytes decoded */
 unsigned int
-databits_decode_ascii8( char *dataout_p, unsigned int dataout_size,
+databits_decode_ascii8( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p )	// databits processor reset: noop
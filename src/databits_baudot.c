@@ -27,14 +27,15 @@
 
 /* returns nbytes decoded */
 unsigned int
-databits_decode_baudot( char *dataout_p, unsigned int dataout_size,
+databits_decode_baudot( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p ) {	// databits processor reset: reset Baudot state
-	    baudot_reset();
+	    baudot_reset(&state->baudot_charset);
 	    return 0;
     }
     bits &= 0x1F;
-    return baudot_decode(dataout_p, bits);
+    return baudot_decode(&state->baudot_charset, dataout_p, bits);
 }
 
@@ -27,7 +27,8 @@
 
 // returns nbytes decoded
 unsigned int
-databits_decode_binary( char *dataout_p, unsigned int dataout_size,
+databits_decode_binary( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p )	// databits processor reset: noop
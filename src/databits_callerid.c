@@ -42,19 +42,14 @@ static const char *cid_datatype_names[] = {
     "Name:"
 };
 
-static int cid_msgtype = 0;
-static int cid_ndata = 0;
-static unsigned char cid_buf[256];
-
-
 static unsigned int
-decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
+decode_mdmf_callerid( databits_state *state, char *dataout_p, unsigned int dataout_size )
 {
     unsigned int dataout_n = 0;
     unsigned int cid_i = 0;
-    unsigned int cid_msglen = cid_buf[1];
+    unsigned int cid_msglen = state->cid_buf[1];
 
-    unsigned char *m = cid_buf + 2;
+    unsigned char *m = state->cid_buf + 2;
     while ( cid_i < cid_msglen ) {
 
 	unsigned int cid_datatype = *m++;
@@ -64,7 +59,7 @@ decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
 	}
 
 	unsigned int cid_datalen = *m++;
-	if ( m + 2 + cid_datalen >= cid_buf + sizeof(cid_buf) ) {
+	if ( m + 2 + cid_datalen >= state->cid_buf + sizeof(state->cid_buf) ) {
 	    // FIXME: bad datastream -- print something here
 	    return 0;
 	}
@@ -119,12 +114,12 @@ decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
 
 
 static unsigned int
-decode_sdmf_callerid( char *dataout_p, unsigned int dataout_size )
+decode_sdmf_callerid( databits_state *state, char *dataout_p, unsigned int dataout_size )
 {
     unsigned int dataout_n = 0;
-    unsigned int cid_msglen = cid_buf[1];
+    unsigned int cid_msglen = state->cid_buf[1];
 
-    unsigned char *m = cid_buf + 2;
+    unsigned char *m = state->cid_buf + 2;
 
     dataout_n += sprintf(dataout_p+dataout_n, "%-6s ",
 			    cid_datatype_names[CID_DATA_DATETIME]);
@@ -146,45 +141,46 @@ decode_sdmf_callerid( char *dataout_p, unsigned int dataout_size )
 }
 
 static unsigned int
-decode_cid_reset()
+decode_cid_reset( databits_state *state )
 {
-    cid_msgtype = 0;
-    cid_ndata = 0;
+    state->cid_msgtype = 0;
+    state->cid_ndata = 0;
     return 0;
 }
 
 // FIXME: doesn't respect dataout_size at all!
 /* returns nbytes decoded */
 unsigned int
-databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
+databits_decode_callerid( databits_state *state,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p )	// databits processor reset
-	return decode_cid_reset();
+	return decode_cid_reset(state);
 
-    if ( cid_msgtype == 0 ) {
+    if ( state->cid_msgtype == 0 ) {
 	if ( bits == CID_MSG_MDMF )
-	    cid_msgtype = CID_MSG_MDMF;
+	    state->cid_msgtype = CID_MSG_MDMF;
 	else if ( bits == CID_MSG_SDMF )
-	    cid_msgtype = CID_MSG_SDMF;
+	    state->cid_msgtype = CID_MSG_SDMF;
 	else
 	    return 0;
-	cid_buf[cid_ndata++] = bits;
+	state->cid_buf[state->cid_ndata++] = bits;
 	return 0;
     }
 
-    if ( cid_ndata >= sizeof(cid_buf) ) {
+    if ( state->cid_ndata >= sizeof(state->cid_buf) ) {
 	// FIXME? buffer overflow; do what here?
-	return decode_cid_reset();
+	return decode_cid_reset(state);
     }
 
-    cid_buf[cid_ndata++] = bits;
+    state->cid_buf[state->cid_ndata++] = bits;
 
     // Collect input bytes until we've collected as many as the message
     // length byte says there will be, plus two (the message type byte
     // and the checksum byte)
-    unsigned long long cid_msglen = cid_buf[1];
-    if ( cid_ndata < cid_msglen + 2)
+    unsigned long long cid_msglen = state->cid_buf[1];
+    if ( state->cid_ndata < cid_msglen + 2)
 	return 0;
 
     // Now we have a whole CID message in cid_buf[] -- decode it
@@ -195,15 +191,15 @@ databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
 
     dataout_n += sprintf(dataout_p+dataout_n, "CALLER-ID\n");
 
-    if ( cid_msgtype == CID_MSG_MDMF )
-	dataout_n += decode_mdmf_callerid(dataout_p+dataout_n,
+    if ( state->cid_msgtype == CID_MSG_MDMF )
+	dataout_n += decode_mdmf_callerid(state, dataout_p+dataout_n,
 						dataout_size-dataout_n);
     else
-	dataout_n += decode_sdmf_callerid(dataout_p+dataout_n,
+	dataout_n += decode_sdmf_callerid(state, dataout_p+dataout_n,
 						dataout_size-dataout_n);
 
     // All done; reset for the next one
-    decode_cid_reset();
+    decode_cid_reset(state);
 
     return dataout_n;
 }
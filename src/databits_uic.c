@@ -52,7 +52,8 @@ databits_decode_uic(char *output,
 }
 
 unsigned int
-databits_decode_uic_ground(char *output,
+databits_decode_uic_ground(databits_state *state,
+	char *output,
 	unsigned int outputSize,
 	unsigned long long input,
 	unsigned int inputSize)
@@ -63,7 +64,8 @@ databits_decode_uic_ground(char *output,
 }
 
 unsigned int
-databits_decode_uic_train(char *output,
+databits_decode_uic_train(databits_state *state,
+	char *output,
 	unsigned int outputSize,
 	unsigned long long input,
 	unsigned int inputSize)
@@ -0,0 +1,385 @@
+/*
+ * fsk-bench.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * fsk-bench: microbenchmarks for the demodulator core
+ *
+ * Times fsk_bit_analyze() and fsk_find_frame() directly over synthetic
+ * 8N1 frames, across a grid of sample rates, baud rates, filter bandwidths
+ * and frame search step sizes, and writes the results to stdout as JSON.
+ * No audio backends are involved, so the numbers only move when the
+ * demodulator does.
+ *
+ * usage: fsk-bench [--reps N] [--warmup N] [--min-time-ms N] [--quick]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "fsk.h"
+
+
+struct bench_mode {
+	const char	*name;
+	float		data_rate;
+	float		mark_f;
+	float		space_f;
+	float		band_width;	// minimodem's default for the rate
+};
+
+// the tone plans minimodem picks for these rates (see minimodem.c)
+static const struct bench_mode bench_modes[] = {
+	{ "rtty",	45.45,	1585,	1415,	10 },
+	{ "300",	300,	1270,	1070,	50 },
+	{ "1200",	1200,	1200,	2200,	200 },
+	{ "12000",	12000,	6600,	16600,	200 },
+};
+
+static const unsigned int bench_sample_rates[] = { 8000, 11025, 48000, 96000 };
+
+// fractions of a bit period per search step: receiver.c's
+// FSK_ANALYZE_NSTEPS and FSK_ANALYZE_NSTEPS_FINE, and a finer one
+static const unsigned int bench_search_nsteps[] = { 3, 8, 32 };
+
+#define FRAME_N_BITS	11	// prev stop, start, 8 data, stop
+static const char *expect_bits_string = "10dddddddd1";
+
+
+static unsigned int nreps = 20;
+static unsigned int nwarmup = 3;
+static double min_rep_ns = 2e6;
+
+
+static unsigned long long
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+compare_double( const void *a, const void *b )
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of a sorted array */
+static double
+percentile( const double *sorted, unsigned int n, double p )
+{
+    unsigned int rank = ceil(p / 100.0 * n);
+    if ( rank < 1 )
+	rank = 1;
+    return sorted[rank - 1];
+}
+
+
+/*
+ * A phase-continuous run of 8N1 frames (preceded by one bit of mark, as
+ * the "prev stop" bit of the first frame) carrying the byte 0x5A.
+ */
+static float *
+synth_frames( const struct bench_mode *m, unsigned int sample_rate,
+	unsigned int nframes, size_t *nsamplesp )
+{
+    double bit_nsamples = sample_rate / m->data_rate;
+    unsigned int nbits = 1 + nframes * (FRAME_N_BITS - 1);
+    size_t nsamples = bit_nsamples * (nbits + 1) + 1;
+    float *samples = calloc(nsamples, sizeof(float));
+    if ( !samples ) {
+	perror("malloc");
+	exit(1);
+    }
+
+    unsigned int byte = 0x5A;
+    double phase = 0;
+    size_t pos = 0;
+    unsigned int b;
+    for ( b=0; b<nbits; b++ ) {
+	unsigned int n = b == 0 ? 0 : (b - 1) % (FRAME_N_BITS - 1);
+	int bit;
+	if ( b == 0 || n == 9 )
+	    bit = 1;			// (prev) stop bit
+	else if ( n == 0 )
+	    bit = 0;			// start bit
+	else
+	    bit = (byte >> (n - 1)) & 1;
+	float f = bit ? m->mark_f : m->space_f;
+	size_t end = bit_nsamples * (b + 1) + 0.5;
+	for ( ; pos<end; pos++ ) {
+	    samples[pos] = sinf(2 * M_PI * phase);
+	    phase += f / sample_rate;
+	    phase -= floor(phase);
+	}
+    }
+
+    *nsamplesp = nsamples;
+    return samples;
+}
+
+
+struct bench_result {
+	double		min, mean, p50, p90, p99, max;	// ns per operation
+	unsigned long long nops;
+};
+
+/*
+ * Call op(arg, i) repeatedly: nwarmup untimed reps, then nreps timed ones
+ * of at least min_rep_ns each.
+ */
+static void
+bench_run( void (*op)(void *arg, unsigned long long i), void *arg,
+	struct bench_result *res )
+{
+    double per_op[nreps];
+    unsigned long long i = 0;
+    unsigned int r;
+
+    // calibrate the number of ops per rep during the warmup
+    unsigned long long batch = 1;
+    for ( r=0; r<nwarmup || r==0; r++ ) {
+	unsigned long long t0 = now_ns(), k;
+	for ( k=0; k<batch; k++ )
+	    op(arg, i++);
+	unsigned long long dt = now_ns() - t0;
+	while ( dt * (batch / (double)k) < min_rep_ns && batch < (1ULL<<30) )
+	    batch *= 2;
+    }
+
+    res->nops = 0;
+    for ( r=0; r<nreps; r++ ) {
+	unsigned long long t0 = now_ns(), k;
+	for ( k=0; k<batch; k++ )
+	    op(arg, i++);
+	per_op[r] = (double)(now_ns() - t0) / batch;
+	res->nops += batch;
+    }
+
+    qsort(per_op, nreps, sizeof(double), compare_double);
+    res->mean = 0;
+    for ( r=0; r<nreps; r++ )
+	res->mean += per_op[r];
+    res->mean /= nreps;
+    res->min = per_op[0];
+    res->max = per_op[nreps - 1];
+    res->p50 = percentile(per_op, nreps, 50);
+    res->p90 = percentile(per_op, nreps, 90);
+    res->p99 = percentile(per_op, nreps, 99);
+}
+
+static void
+print_result( const char *name, const struct bench_result *res )
+{
+    printf("\"%s\": {\"ns_min\": %.1f, \"ns_mean\": %.1f, \"ns_p50\": %.1f, "
+	    "\"ns_p90\": %.1f, \"ns_p99\": %.1f, \"ns_max\": %.1f, \"ops\": %llu}",
+	    name, res->min, res->mean, res->p50, res->p90, res->p99, res->max,
+	    res->nops);
+}
+
+
+struct bench_case {
+	fsk_plan	*fskp;
+	const float	*samples;
+	unsigned int	nframes;
+	float		frame_nsamples;		// per frame, as sent
+	unsigned int	bit_nsamples;
+	unsigned int	expect_nsamples;
+	unsigned int	try_max_nsamples;
+	unsigned int	try_step_nsamples;
+	unsigned int	nbad;			// frames not decoded as sent
+	volatile unsigned int sink;
+};
+
+static void
+op_bit_analyze( void *arg, unsigned long long i )
+{
+    struct bench_case *bc = arg;
+    // walk the bits of the first frame
+    unsigned int bitnum = i % FRAME_N_BITS;
+    unsigned int bit;
+    float sig, noise;
+    fsk_bit_analyze(bc->fskp, bc->samples + bitnum * bc->bit_nsamples,
+	    bc->bit_nsamples, &bit, &sig, &noise);
+    bc->sink += bit;
+}
+
+static void
+op_find_frame( void *arg, unsigned long long i )
+{
+    struct bench_case *bc = arg;
+    // search from half a bit ahead of each frame, as the receiver does
+    unsigned int frame = i % bc->nframes;
+    unsigned int start = frame * bc->frame_nsamples + 0.5f;
+    unsigned int half_bit = bc->bit_nsamples / 2;
+    if ( start >= half_bit )
+	start -= half_bit;
+    unsigned long long bits;
+    float ampl;
+    unsigned int frame_start;
+    float c = fsk_find_frame(bc->fskp, bc->samples + start, bc->expect_nsamples,
+	    0, bc->try_max_nsamples, bc->try_step_nsamples,
+	    INFINITY,	// always search the whole range
+	    expect_bits_string, &bits, &ampl, &frame_start);
+    if ( c <= 0 || ((bits >> 2) & 0xFF) != 0x5A )
+	bc->nbad++;
+}
+
+
+static void
+usage( const char *argv0 )
+{
+    fprintf(stderr,
+	"usage: %s [--reps N] [--warmup N] [--min-time-ms N] [--quick]\n"
+	"  --reps N         timed repetitions per benchmark (default: %u)\n"
+	"  --warmup N       untimed repetitions first (default: %u)\n"
+	"  --min-time-ms N  minimum duration of each repetition (default: %g)\n"
+	"  --quick          a small grid (48000 Hz, no 12000 baud)\n",
+	argv0, nreps, nwarmup, min_rep_ns / 1e6);
+    exit(1);
+}
+
+int
+main( int argc, char *argv[] )
+{
+    int quick = 0;
+
+    static const struct option long_options[] = {
+	{ "reps",		1, 0, 'r' },
+	{ "warmup",		1, 0, 'w' },
+	{ "min-time-ms",	1, 0, 't' },
+	{ "quick",		0, 0, 'q' },
+	{ "help",		0, 0, 'h' },
+	{ 0 }
+    };
+    int c;
+    while ( (c = getopt_long(argc, argv, "r:w:t:qh", long_options, NULL)) != -1 ) {
+	switch ( c ) {
+	    case 'r':	nreps = atoi(optarg);
+			if ( nreps == 0 )
+			    usage(argv[0]);
+			break;
+	    case 'w':	nwarmup = atoi(optarg);
+			break;
+	    case 't':	min_rep_ns = atof(optarg) * 1e6;
+			break;
+	    case 'q':	quick = 1;
+			break;
+	    default:	usage(argv[0]);
+	}
+    }
+    if ( optind != argc )
+	usage(argv[0]);
+
+    printf("{\n\"reps\": %u, \"warmup\": %u, \"min_time_ms\": %g,\n"
+	    "\"results\": [\n", nreps, nwarmup, min_rep_ns / 1e6);
+
+    int first = 1;
+    unsigned int nbad_total = 0;
+    unsigned int ri, mi, bi, si;
+    for ( ri=0; ri<sizeof(bench_sample_rates)/sizeof(bench_sample_rates[0]); ri++ ) {
+	unsigned int sample_rate = bench_sample_rates[ri];
+	if ( quick && sample_rate != 48000 )
+	    continue;
+	for ( mi=0; mi<sizeof(bench_modes)/sizeof(bench_modes[0]); mi++ ) {
+	    const struct bench_mode *m = &bench_modes[mi];
+	    if ( quick && m->data_rate > 1200 )
+		continue;
+	    // the tones must fit below nyquist
+	    if ( fmaxf(m->mark_f, m->space_f) + m->data_rate / 2 >= sample_rate / 2 )
+		continue;
+
+	    size_t nsamples;
+	    unsigned int nframes = 16;
+	    float *samples = synth_frames(m, sample_rate, nframes, &nsamples);
+
+	    // the default bandwidth, and a wide one: up to minimodem's maximum
+	    // (the data rate), but narrow enough to keep the tones apart
+	    float band_widths[2] = { m->band_width,
+			fminf(m->data_rate, fabsf(m->mark_f - m->space_f) / 2) };
+	    for ( bi=0; bi<2; bi++ ) {
+		if ( bi && band_widths[1] <= band_widths[0] )
+		    break;
+		float band_width = band_widths[bi];
+		fsk_plan *fskp = fsk_plan_new(sample_rate, m->mark_f, m->space_f,
+					band_width);
+		if ( !fskp )
+		    continue;
+
+		float bit_nsamples_f = sample_rate / m->data_rate;
+		struct bench_case bc = {
+		    .fskp = fskp,
+		    .samples = samples,
+		    .nframes = nframes - 1,	// leave room to search the last
+		    .frame_nsamples = bit_nsamples_f * (FRAME_N_BITS - 1),
+		    .bit_nsamples = bit_nsamples_f + 0.5f,
+		    .expect_nsamples = bit_nsamples_f * FRAME_N_BITS,
+		    .try_max_nsamples = bit_nsamples_f,
+		};
+
+		struct bench_result bit_res;
+		bench_run(op_bit_analyze, &bc, &bit_res);
+
+		for ( si=0; si<sizeof(bench_search_nsteps)/sizeof(bench_search_nsteps[0]); si++ ) {
+		    unsigned int nsteps = bench_search_nsteps[si];
+		    bc.try_step_nsamples = bc.try_max_nsamples / nsteps;
+		    if ( bc.try_step_nsamples == 0 )
+			bc.try_step_nsamples = 1;
+		    bc.nbad = 0;
+
+		    struct bench_result frame_res;
+		    bench_run(op_find_frame, &bc, &frame_res);
+		    nbad_total += bc.nbad;
+
+		    printf("%s{\"mode\": \"%s\", \"sample_rate\": %u, "
+			    "\"data_rate\": %g, \"band_width\": %g, "
+			    "\"fftsize\": %d, \"bit_nsamples\": %u, "
+			    "\"try_max_nsamples\": %u, \"try_step_nsamples\": %u,\n  ",
+			    first ? "" : ",\n", m->name, sample_rate,
+			    m->data_rate, band_width, fskp->fftsize,
+			    bc.bit_nsamples, bc.try_max_nsamples,
+			    bc.try_step_nsamples);
+		    print_result("bit_analyze", &bit_res);
+		    printf(",\n  ");
+		    print_result("find_frame", &frame_res);
+		    printf(",\n  \"frames_misdecoded\": %u}", bc.nbad);
+		    first = 0;
+		}
+
+		fsk_plan_destroy(fskp);
+	    }
+	    free(samples);
+	}
+    }
+
+    printf("\n]\n}\n");
+
+    if ( nbad_total )
+	fprintf(stderr, "W: %u synthetic frames were misdecoded\n", nbad_total);
+    return 0;
+}
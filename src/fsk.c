@@ -28,8 +28,15 @@
 #include <assert.h>
 
 #include "fsk.h"
+#include "stats.h"
 
 
+static inline unsigned int
+fsk_band_for_freq( fsk_plan *fskp, float f )
+{
+    return (f + fskp->band_width / 2.0f) / fskp->band_width;
+}
+
 fsk_plan *
 fsk_plan_new(
 	float		sample_rate,
@@ -45,6 +52,7 @@ fsk_plan_new(
     fskp->sample_rate = sample_rate;
     fskp->f_mark = f_mark;
     fskp->f_space = f_space;
+    fskp->stats = NULL;
 
 #ifdef USE_FFT
     fskp->band_width = filter_bw;
@@ -53,8 +61,8 @@ fsk_plan_new(
     fskp->fftsize = (sample_rate + fft_half_bw) / fskp->band_width;
     fskp->nbands = fskp->fftsize / 2 + 1;
 
-    fskp->b_mark  = (f_mark  + fft_half_bw) / fskp->band_width;
-    fskp->b_space = (f_space + fft_half_bw) / fskp->band_width;
+    fskp->b_mark  = fsk_band_for_freq(fskp, f_mark);
+    fskp->b_space = fsk_band_for_freq(fskp, f_space);
     if ( fskp->b_mark >= fskp->nbands || fskp->b_space >= fskp->nbands ) {
         fprintf(stderr, "b_mark=%u or b_space=%u is invalid (nbands=%u)\n",
 		fskp->b_mark, fskp->b_space, fskp->nbands);
@@ -72,6 +80,7 @@ fsk_plan_new(
     // FIXME check these:
     fskp->fftin  = fftwf_malloc(fskp->fftsize * sizeof(float) * pa_nchannels);
     bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
+    fskp->fftin_bit_nsamples = 0;
     fskp->fftout = fftwf_malloc(fskp->nbands * sizeof(fftwf_complex) * pa_nchannels);
 
     /* complex fftw plan, works for N channels: */
@@ -104,6 +113,77 @@ fsk_plan_destroy( fsk_plan *fskp )
 }
 
 
+/*
+ * fsk_plan cache: callers which decode many streams (e.g. --batch) share
+ * one plan per distinct {sample_rate, f_mark, f_space, filter_bw}, so that
+ * the FFTW planning cost is paid only once per parameter set.
+ */
+
+struct fsk_plan_cache_entry {
+	float		sample_rate;
+	float		f_mark;
+	float		f_space;
+	float		filter_bw;
+	fsk_plan	*fskp;
+	struct fsk_plan_cache_entry *next;
+};
+
+static struct fsk_plan_cache_entry *fsk_plan_cache;
+
+fsk_plan *
+fsk_plan_cache_get(
+	float		sample_rate,
+	float		f_mark,
+	float		f_space,
+	float		filter_bw
+	)
+{
+    struct fsk_plan_cache_entry *e;
+    for ( e=fsk_plan_cache; e; e=e->next ) {
+	if ( e->sample_rate != sample_rate || e->filter_bw != filter_bw
+		|| e->f_mark != f_mark || e->f_space != f_space )
+	    continue;
+	// The previous user may have moved the tones (--auto-carrier) and
+	// left samples beyond its own bit_nsamples in fftin; start clean.
+	fsk_plan *fskp = e->fskp;
+	fskp->f_mark = f_mark;
+	fskp->f_space = f_space;
+	fskp->b_mark  = fsk_band_for_freq(fskp, f_mark);
+	fskp->b_space = fsk_band_for_freq(fskp, f_space);
+	bzero(fskp->fftin, fskp->fftsize * sizeof(float));
+	fskp->fftin_bit_nsamples = 0;
+	return fskp;
+    }
+
+    e = malloc(sizeof(*e));
+    if ( !e )
+	return NULL;
+    e->fskp = fsk_plan_new(sample_rate, f_mark, f_space, filter_bw);
+    if ( !e->fskp ) {
+	free(e);
+	return NULL;
+    }
+    e->sample_rate = sample_rate;
+    e->f_mark = f_mark;
+    e->f_space = f_space;
+    e->filter_bw = filter_bw;
+    e->next = fsk_plan_cache;
+    fsk_plan_cache = e;
+    return e->fskp;
+}
+
+void
+fsk_plan_cache_flush()
+{
+    while ( fsk_plan_cache ) {
+	struct fsk_plan_cache_entry *e = fsk_plan_cache;
+	fsk_plan_cache = e->next;
+	fsk_plan_destroy(e->fskp);
+	free(e);
+    }
+}
+
+
 static inline float
 band_mag( fftwf_complex * const cplx, unsigned int band, float scalar )
 {
@@ -114,8 +194,8 @@ band_mag( fftwf_complex * const cplx, unsigned int band, float scalar )
 }
 
 
-static void
-fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
+void
+fsk_bit_analyze( fsk_plan *fskp, const float *samples, unsigned int bit_nsamples,
 	unsigned int *bit_outp,
 	float *bit_signal_mag_outp,
 	float *bit_noise_mag_outp
@@ -126,6 +206,13 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
     //
     // unsigned int pa_nchannels = 1;	// FIXME
     // bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
+    //
+    // ... except that receivers sharing a plan may use different bit
+    // lengths, so clear whatever a longer one left behind.
+    if ( fskp->fftin_bit_nsamples > bit_nsamples )
+	bzero(fskp->fftin + bit_nsamples,
+		(fskp->fftin_bit_nsamples - bit_nsamples) * sizeof(float));
+    fskp->fftin_bit_nsamples = bit_nsamples;
 
     memcpy(fskp->fftin, samples, bit_nsamples * sizeof(float));
 
@@ -155,6 +242,7 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 
 
     fftwf_execute(fskp->fftplan);
+    STATS_INC(fskp->stats, fft_execs);
     float mag_mark  = band_mag(fskp->fftout, fskp->b_mark,  magscalar);
     float mag_space = band_mag(fskp->fftout, fskp->b_space, magscalar);
     // mark==1, space==0
@@ -176,7 +264,7 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 
 /* returns confidence value [0.0 to INFINITY] */
 static float
-fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
+fsk_frame_analyze( fsk_plan *fskp, const float *samples, float samples_per_bit,
 	int n_bits, const char *expect_bits_string,
 	unsigned long long *bits_outp, float *ampl_outp )
 {
@@ -194,12 +282,16 @@ fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
 //#define FSK_AVOID_TRANSIENTS	0.7
 
     const char *expect_bits = expect_bits_string;
+    int n_required_checked = 0;
+
+    STATS_INC(fskp->stats, frame_analyses);
 
     /* pass #1 - process and check only the "required" (1/0) expect_bits */
     for ( bitnum=0; bitnum<n_bits; bitnum++ ) {
 	if ( expect_bits[bitnum] == 'd' )
 	    continue;
 	assert( expect_bits[bitnum] == '1' || expect_bits[bitnum] == '0' );
+	n_required_checked++;
 
 	bit_begin_sample = (float)(samples_per_bit * bitnum + 0.5f);
 	debug_log( " bit# %2d @ %7u: ", bitnum, bit_begin_sample);
@@ -208,8 +300,11 @@ fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
 		&bit_sig_mags[bitnum],
 		&bit_noise_mags[bitnum]);
 
-	if ( (expect_bits[bitnum] - '0') != bit_values[bitnum] )
+	if ( (expect_bits[bitnum] - '0') != bit_values[bitnum] ) {
+	    if ( n_required_checked == 1 )
+		STATS_INC(fskp->stats, early_rejects);
 	    return 0.0; /* does not match expected; abort frame analysis. */
+	}
 
 #ifdef FSK_MIN_BIT_SNR
 	float bit_snr = bit_sig_mags[bitnum] / bit_noise_mags[bitnum];
@@ -447,7 +542,7 @@ fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
 
 /* returns confidence value [0.0 to 1.0] */
 float
-fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
+fsk_find_frame( fsk_plan *fskp, const float *samples, unsigned int frame_nsamples,
 	unsigned int try_first_sample,
 	unsigned int try_max_nsamples,
 	unsigned int try_step_nsamples,
@@ -541,7 +636,7 @@ fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
 // #define FSK_AUTODETECT_MAX_FREQ		5000
 
 int
-fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
+fsk_detect_carrier(fsk_plan *fskp, const float *samples, unsigned int nsamples,
 	float min_mag_threshold )
 {
     assert( nsamples <= fskp->fftsize );
@@ -550,6 +645,7 @@ fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
     bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
     memcpy(fskp->fftin, samples, nsamples * sizeof(float));
     fftwf_execute(fskp->fftplan);
+    STATS_INC(fskp->stats, fft_execs);
     float magscalar = 1.0f / ((float)nsamples/2.0f);
     float max_mag = 0.0;
     int max_mag_band = -1;
@@ -581,6 +677,48 @@ fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
 }
 
 
+static float
+goertzel_energy( const float *samples, unsigned int nsamples, float coeff )
+{
+    float s1 = 0.0f, s2 = 0.0f;
+    unsigned int i;
+    for ( i=0; i<nsamples; i++ ) {
+	float s0 = samples[i] + coeff * s1 - s2;
+	s2 = s1;
+	s1 = s0;
+    }
+    return s1*s1 + s2*s2 - coeff*s1*s2;
+}
+
+/*
+ * Cheaply measure (with a pair of Goertzel filters) how much energy there is
+ * at the mark and space tones, next to the total (non-DC) energy.  For a
+ * pure mark tone the two are equal; for white noise tone_energy is about
+ * 4/nsamples of energy.
+ */
+void
+fsk_tone_energy( fsk_plan *fskp, const float *samples, unsigned int nsamples,
+	float *tone_energy_outp, float *energy_outp )
+{
+    float w_mark = 2.0f * M_PI * fskp->b_mark * fskp->band_width
+						/ fskp->sample_rate;
+    float w_space = 2.0f * M_PI * fskp->b_space * fskp->band_width
+						/ fskp->sample_rate;
+    float tone = goertzel_energy(samples, nsamples, 2.0f * cosf(w_mark))
+	       + goertzel_energy(samples, nsamples, 2.0f * cosf(w_space));
+
+    float sum = 0.0f, sumsq = 0.0f;
+    unsigned int i;
+    for ( i=0; i<nsamples; i++ ) {
+	sum += samples[i];
+	sumsq += samples[i] * samples[i];
+    }
+
+    *tone_energy_outp = tone * 2.0f / nsamples;
+    *energy_outp = sumsq - sum * sum / nsamples;
+}
+
+
 void
 fsk_set_tones_by_bandshift( fsk_plan *fskp, unsigned int b_mark, int b_shift )
 {
@@ -17,7 +17,8 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-
+#ifndef FSK_H
+#define FSK_H
 
 #define USE_FFT		// leave this enabled; its presently the only choice
 
@@ -27,6 +28,15 @@
 
 typedef struct fsk_plan fsk_plan;
 
+/* --stats counters, for whoever is using the plan at the moment */
+typedef struct fsk_stats fsk_stats;
+
+struct fsk_stats {
+	unsigned long long	frame_analyses;	// fsk_frame_analyze() calls
+	unsigned long long	early_rejects;	// ... failed at 1st required bit
+	unsigned long long	fft_execs;	// fftwf_execute() calls
+};
+
 struct fsk_plan {
 	float		sample_rate;
     	float		f_mark;
@@ -42,7 +52,9 @@ struct fsk_plan {
 	fftwf_plan	fftplan;
 	float		*fftin;
 	fftwf_complex	*fftout;
+	unsigned int	fftin_bit_nsamples;	// last fsk_bit_analyze() length
 #endif
+	fsk_stats	*stats;			// NULL: not counting
 };
 
 
@@ -57,9 +69,29 @@ fsk_plan_new(
 void
 fsk_plan_destroy( fsk_plan *fskp );
 
+/* returns a shared plan, owned by the cache; do not fsk_plan_destroy() it */
+fsk_plan *
+fsk_plan_cache_get(
+	float		sample_rate,
+    	float		f_mark,
+    	float		f_space,
+	float		filter_bw
+	);
+
+void
+fsk_plan_cache_flush();
+
+/* one bit's worth of samples: the stronger tone (mark==1) and magnitudes */
+void
+fsk_bit_analyze( fsk_plan *fskp, const float *samples, unsigned int bit_nsamples,
+	unsigned int *bit_outp,
+	float *bit_signal_mag_outp,
+	float *bit_noise_mag_outp
+	);
+
 /* returns confidence value [0.0 to 1.0] */
 float
-fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
+fsk_find_frame( fsk_plan *fskp, const float *samples, unsigned int frame_nsamples,
 	unsigned int try_first_sample,
 	unsigned int try_max_nsamples,
 	unsigned int try_step_nsamples,
@@ -71,9 +103,13 @@ fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
 	);
 
 int
-fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
+fsk_detect_carrier(fsk_plan *fskp, const float *samples, unsigned int nsamples,
 	float min_mag_threshold );
 
+void
+fsk_tone_energy( fsk_plan *fskp, const float *samples, unsigned int nsamples,
+	float *tone_energy_outp, float *energy_outp );
+
 void
 fsk_set_tones_by_bandshift( fsk_plan *fskp, unsigned int b_mark, int b_shift );
 
@@ -86,3 +122,4 @@ fsk_set_tones_by_bandshift( fsk_plan *fskp, unsigned int b_mark, int b_shift );
 # define debug_log(format, args...)
 #endif
 
+#endif
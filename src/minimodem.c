@@ -30,8 +30,12 @@
 #include <float.h>
 #include <assert.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <pthread.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -43,30 +47,256 @@
 #include "fsk.h"
 #include "databits.h"
 #include "baudot.h"
+#include "receiver.h"
+#include "batch.h"
+#include "daemon.h"
 
 char *program_name = "";
 
 int		tx_transmitting = 0;
 int		tx_print_eot = 0;
-int		tx_leader_bits_len = 2;
 int		tx_trailer_bits_len = 2;
 
+#define TX_LEADER_BITS_LEN	2
+
+/* the leader for a mode: none if there are no start bits */
+static unsigned int
+tx_leader_nbits( const receiver_config *cfg )
+{
+    return cfg->nstartbits == 0 ? 0 : TX_LEADER_BITS_LEN;
+}
+
 simpleaudio	*tx_sa_out;
 float		tx_bfsk_mark_f;
-unsigned int	tx_bit_nsamples;
+double		tx_bit_nsamples;	// sample_rate / data_rate (exactly)
 unsigned int	tx_flush_nsamples;
 
-void
-tx_stop_transmit_sighandler( int sig )
+/*
+ * The transmitter synthesizes each character's frames (or a leader, idle
+ * tone or trailer) into tx_buf, then writes them with one
+ * simpleaudio_write().  tx_buf is sized up front for the longest of those,
+ * so transmitting does not allocate.
+ *
+ * There are TX_NBUFS such buffers: tx_flush() queues the one just filled
+ * for the writer thread, and synthesis goes on into the next, so that
+ * while a (blocking) write to an audio device or file is under way, the
+ * next block of audio is being made.  If a write fails, the writer sets
+ * tx_buf.failed and discards anything queued after it, and tx_flush(),
+ * tx_drain() and tx_writer_stop() return -1 from then on.
+ */
+#define TX_NBUFS	3
+
+static struct {
+	void			*buf;		// the buffer being filled
+	size_t			size;		// in samples
+	size_t			nsamples;	// synthesized, not yet queued
+	unsigned int		framesize;
+	unsigned long long	frames;		// counts, for --stats
+	unsigned long long	samples;
+	unsigned long long	writes;
+	unsigned long long	allocs;
+	unsigned long long	write_waits;	// all buffers were queued
+
+	void			*bufs[TX_NBUFS];
+	size_t			bufs_nsamples[TX_NBUFS];
+	unsigned int		fill;		// bufs[fill] == buf
+	unsigned int		next_write;	// the oldest queued buffer
+	unsigned int		nqueued;
+	int			stop;		// end of TX: writer exits
+	int			failed;		// a write failed
+	simpleaudio		*sa_out;
+	pthread_t		writer;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+} tx_buf = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+#define TX_BLOCK_NSAMPLES	65536	// tx_buf size for non-interactive TX
+
+static void *
+tx_writer_thread( void *arg )
+{
+    pthread_mutex_lock(&tx_buf.lock);
+    for ( ;; ) {
+	while ( !tx_buf.nqueued && !tx_buf.stop )
+	    pthread_cond_wait(&tx_buf.cond, &tx_buf.lock);
+	if ( !tx_buf.nqueued )
+	    break;
+	unsigned int i = tx_buf.next_write;
+	int failed = tx_buf.failed;
+	pthread_mutex_unlock(&tx_buf.lock);
+
+	if ( !failed && simpleaudio_write(tx_buf.sa_out, tx_buf.bufs[i],
+			tx_buf.bufs_nsamples[i]) != tx_buf.bufs_nsamples[i] )
+	    failed = 1;
+
+	pthread_mutex_lock(&tx_buf.lock);
+	tx_buf.failed = failed;
+	tx_buf.next_write = (i + 1) % TX_NBUFS;
+	tx_buf.nqueued--;
+	pthread_cond_broadcast(&tx_buf.cond);
+    }
+    pthread_mutex_unlock(&tx_buf.lock);
+    return NULL;
+}
+
+/* wait for the writer to write all the queued buffers */
+static int
+tx_drain()
 {
-    // fprintf(stderr, "alarm\n");
+    pthread_mutex_lock(&tx_buf.lock);
+    while ( tx_buf.nqueued )
+	pthread_cond_wait(&tx_buf.cond, &tx_buf.lock);
+    int failed = tx_buf.failed;
+    pthread_mutex_unlock(&tx_buf.lock);
+    return failed ? -1 : 0;
+}
+
+static void
+tx_buf_reserve( simpleaudio *sa_out, size_t nsamples )
+{
+    if ( tx_buf.size >= nsamples )
+	return;
+    tx_drain();
+    tx_buf.framesize = simpleaudio_get_framesize(sa_out);
+    unsigned int i;
+    for ( i=0; i<TX_NBUFS; i++ ) {
+	tx_buf.bufs[i] = realloc(tx_buf.bufs[i], nsamples * tx_buf.framesize);
+	if ( !tx_buf.bufs[i] ) {
+	    perror("malloc");
+	    exit(1);
+	}
+    }
+    tx_buf.buf = tx_buf.bufs[tx_buf.fill];
+    tx_buf.size = nsamples;
+    tx_buf.allocs++;
+}
 
+static void
+tx_tone( simpleaudio *sa_out, float tone_freq, size_t nsamples )
+{
+    tx_buf_reserve(sa_out, tx_buf.nsamples + nsamples);
+    simpleaudio_tone_fill(sa_out,
+	    (char *)tx_buf.buf + tx_buf.nsamples * tx_buf.framesize,
+	    tone_freq, nsamples);
+    tx_buf.nsamples += nsamples;
+}
+
+static int
+tx_write_failed()
+{
+    pthread_mutex_lock(&tx_buf.lock);
+    int failed = tx_buf.failed;
+    pthread_mutex_unlock(&tx_buf.lock);
+    return failed;
+}
+
+static int
+tx_flush( simpleaudio *sa_out )
+{
+    if ( !tx_buf.nsamples )
+	return tx_write_failed() ? -1 : 0;
+    pthread_mutex_lock(&tx_buf.lock);
+    if ( tx_buf.nqueued == TX_NBUFS-1 ) {
+	tx_buf.write_waits++;
+	while ( tx_buf.nqueued == TX_NBUFS-1 )
+	    pthread_cond_wait(&tx_buf.cond, &tx_buf.lock);
+    }
+    tx_buf.bufs_nsamples[tx_buf.fill] = tx_buf.nsamples;
+    tx_buf.nqueued++;
+    tx_buf.fill = (tx_buf.fill + 1) % TX_NBUFS;
+    pthread_cond_broadcast(&tx_buf.cond);
+    int failed = tx_buf.failed;
+    pthread_mutex_unlock(&tx_buf.lock);
+
+    tx_buf.buf = tx_buf.bufs[tx_buf.fill];
+    tx_buf.samples += tx_buf.nsamples;
+    tx_buf.writes++;
+    tx_buf.nsamples = 0;
+    return failed ? -1 : 0;
+}
+
+static void
+tx_writer_start( simpleaudio *sa_out )
+{
+    tx_buf.sa_out = sa_out;
+    tx_buf.stop = 0;
+    tx_buf.failed = 0;
+    int err = pthread_create(&tx_buf.writer, NULL, tx_writer_thread, NULL);
+    if ( err ) {
+	fprintf(stderr, "E: pthread_create: %s\n", strerror(err));
+	exit(1);
+    }
+}
+
+/* write out everything queued, and end the writer thread */
+static int
+tx_writer_stop()
+{
+    pthread_mutex_lock(&tx_buf.lock);
+    tx_buf.stop = 1;
+    pthread_cond_broadcast(&tx_buf.cond);
+    pthread_mutex_unlock(&tx_buf.lock);
+    pthread_join(tx_buf.writer, NULL);
+    return tx_buf.failed ? -1 : 0;
+}
+
+/* free the transmit buffers, and zero the counts (for --benchmarks) */
+static void
+tx_buf_release()
+{
+    unsigned int i;
+    for ( i=0; i<TX_NBUFS; i++ ) {
+	free(tx_buf.bufs[i]);
+	tx_buf.bufs[i] = NULL;
+    }
+    tx_buf.buf = NULL;
+    tx_buf.size = tx_buf.nsamples = 0;
+    tx_buf.fill = tx_buf.next_write = tx_buf.nqueued = 0;
+    tx_buf.frames = tx_buf.samples = tx_buf.writes = 0;
+    tx_buf.allocs = tx_buf.write_waits = 0;
+}
+
+static unsigned long long
+tx_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Emit a tone lasting a fractional number of samples (bit times).  The
+ * bit clock is kept to a fraction of a sample, so that every bit boundary
+ * lands on the sample nearest to where it belongs whatever sample_rate /
+ * data_rate comes to, without drifting over bits and frames.
+ */
+static double tx_sample_frac;	// the bit clock's lead over the samples sent
+
+static void
+tx_bit_tone( simpleaudio *sa_out, float tone_freq, double nsamples )
+{
+    double end = tx_sample_frac + nsamples;
+    long n = lround(end);
+    tx_sample_frac = end - n;
+    if ( n > 0 )
+	tx_tone(sa_out, tone_freq, n);
+}
+
+/* emit the trailer: the end of a transmission */
+static void
+tx_stop_transmit()
+{
     int j;
     for ( j=0; j<tx_trailer_bits_len; j++ )
-	simpleaudio_tone(tx_sa_out, tx_bfsk_mark_f, tx_bit_nsamples);
+	tx_bit_tone(tx_sa_out, tx_bfsk_mark_f, tx_bit_nsamples);
 
     if ( tx_flush_nsamples )
-	simpleaudio_tone(tx_sa_out, 0, tx_flush_nsamples);
+	tx_tone(tx_sa_out, 0, tx_flush_nsamples);
+
+    tx_flush(tx_sa_out);
 
     tx_transmitting = 0;
     if ( tx_print_eot )
@@ -82,7 +312,7 @@ static void fsk_transmit_frame(
 	simpleaudio *sa_out,
 	unsigned int bits,
 	unsigned int n_data_bits,
-	size_t bit_nsamples,
+	double bit_nsamples,
 	float bfsk_mark_f,
 	float bfsk_space_f,
 	float bfsk_nstartbits,
@@ -93,7 +323,7 @@ static void fsk_transmit_frame(
 {
     int i;
     if ( bfsk_nstartbits > 0 )
-	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_mark_f : bfsk_space_f,
+	tx_bit_tone(sa_out, invert_start_stop ? bfsk_mark_f : bfsk_space_f,
 			bit_nsamples * bfsk_nstartbits);	// start
     for ( i=0; i<n_data_bits; i++ ) {				// data
 	unsigned int bit;
@@ -104,14 +334,16 @@ static void fsk_transmit_frame(
 	}
 
 	float tone_freq = bit == 1 ? bfsk_mark_f : bfsk_space_f;
-	simpleaudio_tone(sa_out, tone_freq, bit_nsamples);
+	tx_bit_tone(sa_out, tone_freq, bit_nsamples);
     }
     if ( bfsk_nstopbits > 0 )
-	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f,
+	tx_bit_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f,
 			bit_nsamples * bfsk_nstopbits);		// stop
+    tx_buf.frames++;
 }
 
-static void fsk_transmit_stdin(
+/* returns -1 if writing the audio failed */
+static int fsk_transmit_stdin(
 	simpleaudio *sa_out,
 	int tx_interactive,
 	float data_rate,
@@ -124,42 +356,64 @@ static void fsk_transmit_stdin(
 	int bfsk_msb_first,
 	unsigned int bfsk_do_tx_sync_bytes,
 	unsigned int bfsk_sync_byte,
+	unsigned int n_leader_bits,
 	databits_encoder encode,
 	int txcarrier
 	)
 {
     size_t sample_rate = simpleaudio_get_rate(sa_out);
-    size_t bit_nsamples = sample_rate / data_rate + 0.5f;
+    double bit_nsamples = (double)sample_rate / data_rate;
 
     tx_sa_out = sa_out;
     tx_bfsk_mark_f = bfsk_mark_f;
     tx_bit_nsamples = bit_nsamples;
+    tx_sample_frac = 0;
     if ( tx_interactive )
 	tx_flush_nsamples = sample_rate/2; // 0.5 sec of zero samples to flush
     else
 	tx_flush_nsamples = 0;
 
-    // one-shot
-    struct itimerval itv = {
-	{0, 0},						// it_interval
-	{0, 1000000/(float)(data_rate+data_rate*0.03f)}	// it_value
-    };
-
-    struct itimerval itv_zero = {
-	{0, 0},						// it_interval
-	{0, 0}						// it_value
-    };
-
     // arbitrary chosen timeout value: 1/25 of a second
     unsigned int idle_carrier_usec = (1000000/25);
 
+    // size tx_buf for the most that is written at once: the leader, sync
+    // bytes and frames for one character, the idle tone, or the trailer
+    // (or when not interactive, a block of characters; see below)
+    size_t bit_max_nsamples = bit_nsamples + 1;
+    size_t frame_nsamples = bit_max_nsamples * (bfsk_nstartbits + n_data_bits
+					    + bfsk_nstopbits + 1);
+    size_t char_nsamples = n_leader_bits * bit_max_nsamples
+			+ (bfsk_do_tx_sync_bytes + 2) * frame_nsamples;
+    size_t max_nsamples = char_nsamples;
+    size_t idle_nsamples = idle_carrier_usec * sample_rate / 1000000;
+    if ( max_nsamples < idle_nsamples )
+	max_nsamples = idle_nsamples;
+    if ( max_nsamples < tx_trailer_bits_len * bit_max_nsamples + tx_flush_nsamples )
+	max_nsamples = tx_trailer_bits_len * bit_max_nsamples + tx_flush_nsamples;
+    if ( !tx_interactive && max_nsamples < TX_BLOCK_NSAMPLES )
+	max_nsamples = TX_BLOCK_NSAMPLES;
+    tx_buf_reserve(sa_out, max_nsamples);
+    tx_writer_start(sa_out);
+
+    /*
+     * Interactively (unless --tx-carrier), a transmission ends with the
+     * trailer once no more input has arrived for about a bit time after
+     * the last character; the input poll() times out at that deadline.
+     */
     int block_input = tx_interactive && !txcarrier;
-    if ( block_input )
-	signal(SIGALRM, tx_stop_transmit_sighandler);
+    unsigned long long trailer_delay_ns = 1e9 / (data_rate+data_rate*0.03f);
+    unsigned long long trailer_deadline_ns = 0;	// 0: none pending
+
+    struct pollfd pfd = { .fd = fileno(stdin), .events = POLLIN };
 
-    // Set up for select() should we need it
-    int fd = fileno(stdin);
-    fd_set fdset;
+    /*
+     * Interactively, read and send one character at a time.  Otherwise
+     * (i.e. writing to an audio file) read stdin in blocks, and send
+     * whole blocks of characters per write, up to the size of tx_buf.
+     */
+    unsigned char inbuf[4096];
+    size_t in_size = tx_interactive ? 1 : sizeof(inbuf);
+    size_t in_pos = 0, in_nbytes = 0;
 
     tx_transmitting = 0;
     int end_of_file = 0;
@@ -168,48 +422,70 @@ static void fsk_transmit_stdin(
     int idle = 0;
     while ( !end_of_file )
     {
-        FD_ZERO(&fdset);
-        FD_SET(fd, &fdset);
-        struct timeval tv_idletimeout = { 0, 0 };
-
-	if ( !tx_interactive ) {
-	    // When stdin blocks we "emit idle tone", for a duration of
-	    // idle_carrier_usec.  If !tx_interactive (i.e. writing to an
-	    // audio file) make the select timeout the same duration.
-	    tv_idletimeout.tv_usec = idle_carrier_usec;
+	// When stdin blocks we "emit idle tone", for a duration of
+	// idle_carrier_usec: if !tx_interactive (i.e. writing to an audio
+	// file) wait that long for input, and with --tx-carrier not at all.
+	int timeout_ms = 0;
+	if ( !tx_interactive )
+	    timeout_ms = idle_carrier_usec / 1000;
+	else if ( block_input && !trailer_deadline_ns )
+	    timeout_ms = -1;
+	else if ( block_input ) {
+	    unsigned long long now = tx_now_ns();
+	    timeout_ms = now >= trailer_deadline_ns ? 0
+			: (trailer_deadline_ns - now + 999999) / 1000000;
 	}
 
-        if( block_input || select(fd+1, &fdset, NULL, NULL, &tv_idletimeout) )
+	int ready = 1;
+	if ( in_pos == in_nbytes ) {
+	    ready = poll(&pfd, 1, timeout_ms);
+	    if ( ready < 0 ) {
+		if ( errno == EINTR )
+		    continue;
+		perror("poll");
+		break;
+	    }
+	}
+
+	if ( in_pos < in_nbytes )
+	    idle = 0;	// still sending the block last read
+	else if ( ready )
         {
-	    n_read = read(fd, &buf, sizeof(buf));
+	    n_read = read(pfd.fd, inbuf, in_size);
 	    if( n_read <= 0 ) //Includes EOF (0) and errors (-1)
 	    {
 		end_of_file = 1;
 		continue;     //Do nothing else
 	    }
+	    in_pos = 0;
+	    in_nbytes = n_read;
             idle = 0;
         }
+	else if ( block_input )
+	{
+	    // no input by the deadline: end this transmission
+	    tx_stop_transmit();
+	    trailer_deadline_ns = 0;
+	    continue;
+	}
 	else
 	    idle = 1;
 
-	// Cause any running timer to immediately trigger
-	if ( block_input )
-	    setitimer(ITIMER_REAL, &itv_zero, NULL);
-
 	if( !idle )
 	{
 	    // fprintf(stderr, "<c=%d>", c);
 	    unsigned int nwords;
 	    unsigned int bits[2];
 	    unsigned int j;
+	    buf = inbuf[in_pos++];
 	    nwords = encode(bits, buf);
 
 	    if ( !tx_transmitting )
 	    {
 	        tx_transmitting = 1;
                 /* emit leader tone (mark) */
-                for ( j=0; j<tx_leader_bits_len; j++ )
-                    simpleaudio_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f, bit_nsamples);
+                for ( j=0; j<n_leader_bits; j++ )
+                    tx_bit_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f, bit_nsamples);
 	    }
 	    if ( tx_transmitting < 2)
 	    {
@@ -231,65 +507,26 @@ static void fsk_transmit_stdin(
         {
 	    tx_transmitting = 1;
             /* emit idle tone (mark) */
-	    simpleaudio_tone(sa_out,
+	    tx_tone(sa_out,
 		    invert_start_stop ? bfsk_space_f : bfsk_mark_f,
-		    idle_carrier_usec * sample_rate / 1000000);
+		    idle_nsamples);
+	}
+	if ( in_pos == in_nbytes
+		|| tx_buf.nsamples + char_nsamples > tx_buf.size ) {
+	    if ( tx_flush(sa_out) < 0 )
+		break;		// no use making more
 	}
 
 	if ( block_input )
-	    setitimer(ITIMER_REAL, &itv, NULL);
-    }
-    if ( block_input ) {
-	setitimer(ITIMER_REAL, &itv_zero, NULL);
-	signal(SIGALRM, SIG_DFL);
+	    trailer_deadline_ns = tx_now_ns() + trailer_delay_ns;
     }
-    if ( !tx_transmitting )
-	return;
+    if ( tx_transmitting && !tx_write_failed() )
+	tx_stop_transmit();
 
-    tx_stop_transmit_sighandler(0);
+    return tx_writer_stop();
 }
 
 
-static void
-report_no_carrier( fsk_plan *fskp,
-	unsigned int sample_rate,
-	float bfsk_data_rate,
-	float frame_n_bits,
-	unsigned int nframes_decoded,
-	size_t carrier_nsamples,
-	float confidence_total,
-	float amplitude_total )
-{
-    float nbits_decoded = nframes_decoded * frame_n_bits;
-#if 0
-    fprintf(stderr, "nframes_decoded=%u\n", nframes_decoded);
-    fprintf(stderr, "nbits_decoded=%f\n", nbits_decoded);
-    fprintf(stderr, "carrier_nsamples=%lu\n", carrier_nsamples);
-#endif
-    float throughput_rate =
-		nbits_decoded * sample_rate / (float)carrier_nsamples;
-    fprintf(stderr, "\n### NOCARRIER ndata=%u confidence=%.3f ampl=%.3f bps=%.2f",
-	    nframes_decoded,
-	    (double)(confidence_total / nframes_decoded),
-	    (double)(amplitude_total / nframes_decoded),
-	    (double)(throughput_rate));
-#if 0
-    fprintf(stderr, " bits*sr=%llu rate*nsamp=%llu",
-	    (unsigned long long)(nbits_decoded * sample_rate + 0.5),
-	    (unsigned long long)(bfsk_data_rate * carrier_nsamples) );
-#endif
-    if ( (unsigned long long)(nbits_decoded * sample_rate + 0.5f) == (unsigned long long)(bfsk_data_rate * carrier_nsamples) ) {
-	fprintf(stderr, " (rate perfect) ###\n");
-    } else {
-	float throughput_skew = (throughput_rate - bfsk_data_rate)
-			    / bfsk_data_rate;
-	fprintf(stderr, " (%.1f%% %s) ###\n",
-		(double)(fabsf(throughput_skew) * 100.0f),
-		signbit(throughput_skew) ? "slow" : "fast"
-		);
-    }
-}
-
 void
 generate_test_tones( simpleaudio *sa_out, unsigned int duration_sec )
 {
@@ -302,6 +539,9 @@ generate_test_tones( simpleaudio *sa_out, unsigned int duration_sec )
     }
 }
 
+static void tx_benchmarks();
+static void rx_benchmarks();
+
 static int
 benchmarks()
 {
@@ -361,11 +601,15 @@ benchmarks()
     simpleaudio_close(sa_out);
 
 
+    tx_benchmarks();
+
+    rx_benchmarks();
+
     return 1;
 }
 
 
-static int rx_stop = 0;
+static volatile sig_atomic_t rx_stop = 0;
 
 void
 rx_stop_sighandler( int sig )
@@ -373,6 +617,12 @@ rx_stop_sighandler( int sig )
     rx_stop = 1;
 }
 
+void
+rx_stats_sighandler( int sig )
+{
+    receiver_stats_requested = 1;
+}
+
 
 void
 version()
@@ -392,6 +642,8 @@ usage()
 {
     fprintf(stderr,
     "usage: minimodem [--tx|--rx] [options] {baudmode}\n"
+    "       minimodem --rx --batch [options] {baudmode} [files...]\n"
+    "       minimodem --rx --daemon {socket} [--daemon-jobs {n}]\n"
     "		    -t, --tx, --transmit, --write\n"
     "		    -r, --rx, --receive,  --read     (default)\n"
     "		[options]\n"
@@ -426,6 +678,12 @@ usage()
     "		    --print-filter\n"
     "		    --print-eot\n"
     "		    --tx-carrier\n"
+    "		    --raw [--raw-format {s16|s24|s32|u8|float}]\n"
+    "		    --stats\n"
+    "		    --events-fd {fd}\n"
+    "		    --rt-budget {fraction} [--rt-effort {min}:{max}]\n"
+    "		    --low-latency\n"
+    "		    --batch [--batch-jobs {n}] [--batch-output {dir}]\n"
     "		{baudmode}\n"
     "	    any_number_N       Bell-like      N bps --ascii\n"
     "		    1200       Bell202     1200 bps --ascii\n"
@@ -439,55 +697,160 @@ usage()
     exit(1);
 }
 
-int
-build_expect_bits_string( char *expect_bits_string,
-	int bfsk_nstartbits,
-	int bfsk_n_data_bits,
-	float bfsk_nstopbits,
-	int invert_start_stop,
-	int use_expect_bits,
-	unsigned long long expect_bits )
-{
-	// example expect_bits_string
-	//	  0123456789A
-	//	  isddddddddp	i == idle bit (a.k.a. prev_stop bit)
-	//			s == start bit  d == data bits  p == stop bit
-	// ebs = "10dddddddd1"  <-- expected mark/space framing pattern
-	//
-	// NOTE! expect_n_bits ends up being (frame_n_bits+1), because
-	// we expect the prev_stop bit in addition to this frame's own
-	// (start + n_data_bits + stop) bits.  But for each decoded frame,
-	// we will advance just frame_n_bits worth of samples, leaving us
-	// pointing at our stop bit -- it becomes the next frame's prev_stop.
-	//
-	//                  prev_stop--v
-	//                       start--v        v--stop
-	// char *expect_bits_string = "10dddddddd1";
-	//
-	char start_bit_value = invert_start_stop ? '1' : '0';
-	char stop_bit_value = invert_start_stop ? '0' : '1';
-	int j = 0;
-	if ( bfsk_nstopbits != 0.0f )
-	    expect_bits_string[j++] = stop_bit_value;
-	int i;
-	// Nb. only integer number of start bits works (for rx)
-	for ( i=0; i<bfsk_nstartbits; i++ )
-	    expect_bits_string[j++] = start_bit_value;
-	for ( i=0; i<bfsk_n_data_bits; i++,j++ ) {
-	    if ( use_expect_bits )
-		expect_bits_string[j] = ( (expect_bits>>i)&1 ) + '0';
-	    else
-		expect_bits_string[j] = 'd';
-	}
-	if ( bfsk_nstopbits != 0.0f )
-	    expect_bits_string[j++] = stop_bit_value;
-	expect_bits_string[j] = 0;
+/*
+ * Everything selected by the command line (or, for the receive side,
+ * by a --daemon connection header).
+ */
+struct minimodem_options {
+	int		TX_mode;
+	char		*filename;
+	sa_backend_t	sa_backend;
+	char		*sa_backend_device;
+	sa_format_t	sample_format;
+	unsigned int	sample_rate;
+	float		tx_amplitude;
+	unsigned int	tx_sin_table_len;
+	float		rxnoise_factor;
+	int		txcarrier;
+	unsigned int	tx_sync_bytes;
+	databits_encoder *databits_encode;
+	int		batch_mode;
+	unsigned int	batch_njobs;
+	char		*batch_output_dir;
+	char		*daemon_socket;
+	unsigned int	daemon_njobs;
+	int		raw;
+	char		*raw_format;	// --raw-format, or NULL
+	int		argind;		// argv index following {baudmode}
+	receiver_config	rx;
+};
+
+enum {
+	MINIMODEM_OPT_UNUSED=256,	// placeholder
+	MINIMODEM_OPT_MSBFIRST,
+	MINIMODEM_OPT_STARTBITS,
+	MINIMODEM_OPT_STOPBITS,
+	MINIMODEM_OPT_INVERT_START_STOP,
+	MINIMODEM_OPT_SYNC_BYTE,
+	MINIMODEM_OPT_LUT,
+	MINIMODEM_OPT_FLOAT_SAMPLES,
+	MINIMODEM_OPT_RX_ONE,
+	MINIMODEM_OPT_BENCHMARKS,
+	MINIMODEM_OPT_BINARY_OUTPUT,
+	MINIMODEM_OPT_BINARY_RAW,
+	MINIMODEM_OPT_PRINT_FILTER,
+	MINIMODEM_OPT_XRXNOISE,
+	MINIMODEM_OPT_PRINT_EOT,
+	MINIMODEM_OPT_TXCARRIER,
+	MINIMODEM_OPT_BATCH,
+	MINIMODEM_OPT_BATCH_JOBS,
+	MINIMODEM_OPT_BATCH_OUTPUT,
+	MINIMODEM_OPT_DAEMON,
+	MINIMODEM_OPT_DAEMON_JOBS,
+	MINIMODEM_OPT_RAW,
+	MINIMODEM_OPT_RAW_FORMAT,
+	MINIMODEM_OPT_STATS,
+	MINIMODEM_OPT_EVENTS_FD,
+	MINIMODEM_OPT_RT_BUDGET,
+	MINIMODEM_OPT_RT_EFFORT,
+	MINIMODEM_OPT_LOW_LATENCY,
+};
+
+static struct option long_options[] = {
+	{ "version",	0, 0, 'V' },
+	{ "tx",		0, 0, 't' },
+	{ "transmit",	0, 0, 't' },
+	{ "write",		0, 0, 't' },
+	{ "rx",		0, 0, 'r' },
+	{ "receive",	0, 0, 'r' },
+	{ "read",		0, 0, 'r' },
+	{ "confidence",	1, 0, 'c' },
+	{ "limit",		1, 0, 'l' },
+	{ "auto-carrier",	0, 0, 'a' },
+	{ "inverted",	0, 0, 'i' },
+	{ "ascii",		0, 0, '8' },
+	{ "",		0, 0, '7' },
+	{ "baudot",		0, 0, '5' },
+	{ "usos",  		1, 0, 'u' },
+	{ "msb-first",	0, 0, MINIMODEM_OPT_MSBFIRST },
+	{ "file",		1, 0, 'f' },
+	{ "bandwidth",	1, 0, 'b' },
+	{ "volume",		1, 0, 'v' },
+	{ "mark",		1, 0, 'M' },
+	{ "space",		1, 0, 'S' },
+	{ "startbits",	1, 0, MINIMODEM_OPT_STARTBITS },
+	{ "stopbits",	1, 0, MINIMODEM_OPT_STOPBITS },
+	{ "invert-start-stop", 0, 0, MINIMODEM_OPT_INVERT_START_STOP },
+	{ "sync-byte",	1, 0, MINIMODEM_OPT_SYNC_BYTE },
+	{ "quiet",		0, 0, 'q' },
+	{ "alsa",		2, 0, 'A' },
+	{ "sndio",		2, 0, 's' },
+	{ "samplerate",	1, 0, 'R' },
+	{ "lut",		1, 0, MINIMODEM_OPT_LUT },
+	{ "float-samples",	0, 0, MINIMODEM_OPT_FLOAT_SAMPLES },
+	{ "rx-one",		0, 0, MINIMODEM_OPT_RX_ONE },
+	{ "benchmarks",	0, 0, MINIMODEM_OPT_BENCHMARKS },
+	{ "binary-output",	0, 0, MINIMODEM_OPT_BINARY_OUTPUT },
+	{ "binary-raw",	1, 0, MINIMODEM_OPT_BINARY_RAW },
+	{ "print-filter",	0, 0, MINIMODEM_OPT_PRINT_FILTER },
+	{ "print-eot",	0, 0, MINIMODEM_OPT_PRINT_EOT },
+	{ "Xrxnoise",	1, 0, MINIMODEM_OPT_XRXNOISE },
+	{ "tx-carrier",      0, 0, MINIMODEM_OPT_TXCARRIER },
+	{ "batch",		0, 0, MINIMODEM_OPT_BATCH },
+	{ "batch-jobs",	1, 0, MINIMODEM_OPT_BATCH_JOBS },
+	{ "batch-output",	1, 0, MINIMODEM_OPT_BATCH_OUTPUT },
+	{ "daemon",		1, 0, MINIMODEM_OPT_DAEMON },
+	{ "daemon-jobs",	1, 0, MINIMODEM_OPT_DAEMON_JOBS },
+	{ "raw",		0, 0, MINIMODEM_OPT_RAW },
+	{ "raw-format",		1, 0, MINIMODEM_OPT_RAW_FORMAT },
+	{ "stats",		0, 0, MINIMODEM_OPT_STATS },
+	{ "events-fd",		1, 0, MINIMODEM_OPT_EVENTS_FD },
+	{ "rt-budget",		1, 0, MINIMODEM_OPT_RT_BUDGET },
+	{ "rt-effort",		1, 0, MINIMODEM_OPT_RT_EFFORT },
+	{ "low-latency",	0, 0, MINIMODEM_OPT_LOW_LATENCY },
+	{ 0 }
+};
 
-	return j;
+/*
+ * The options which may appear in a --daemon connection header: those
+ * which only shape the decoding of that one stream.
+ */
+static int
+option_is_per_stream( int c )
+{
+    switch ( c ) {
+	case 'r': case 'c': case 'l': case 'a': case 'i':
+	case '8': case '7': case '5':
+	case 'b': case 'M': case 'S': case 'q': case 'R':
+	case MINIMODEM_OPT_MSBFIRST:
+	case MINIMODEM_OPT_STARTBITS:
+	case MINIMODEM_OPT_STOPBITS:
+	case MINIMODEM_OPT_INVERT_START_STOP:
+	case MINIMODEM_OPT_SYNC_BYTE:
+	case MINIMODEM_OPT_FLOAT_SAMPLES:
+	case MINIMODEM_OPT_RX_ONE:
+	case MINIMODEM_OPT_BINARY_OUTPUT:
+	case MINIMODEM_OPT_BINARY_RAW:
+	case MINIMODEM_OPT_PRINT_FILTER:
+	case MINIMODEM_OPT_STATS:
+	case MINIMODEM_OPT_RT_BUDGET:
+	case MINIMODEM_OPT_RT_EFFORT:
+	case MINIMODEM_OPT_LOW_LATENCY:
+	    return 1;
+    }
+    return 0;
 }
 
-int
-main( int argc, char*argv[] )
+/*
+ * Parse argv into *opts and resolve the {baudmode}.  If is_header, argv
+ * is a --daemon connection header rather than the command line.
+ *
+ * Returns 0 on success, -1 for a usage error, or 1 for an error which has
+ * already been reported.
+ */
+static int
+parse_options( struct minimodem_options *opts, int argc, char *argv[],
+	int is_header )
 {
     char *modem_mode = NULL;
     int TX_mode = -1;
@@ -505,8 +868,7 @@ main( int argc, char*argv[] )
     unsigned int bfsk_n_data_bits = 0;
     int bfsk_msb_first = 0;
     char *expect_data_string = NULL;
-    char *expect_sync_string = NULL;
-    unsigned int expect_n_bits;
+    unsigned int expect_n_bits = 0;
     int invert_start_stop = 0;
     int autodetect_shift;
     char *filename = NULL;
@@ -532,12 +894,17 @@ main( int argc, char*argv[] )
     char *sa_backend_device = NULL;
     sa_format_t sample_format = SA_SAMPLE_FORMAT_S16;
     unsigned int sample_rate = 48000;
-    unsigned int nchannels = 1; // FIXME: only works with one channel
 
     float tx_amplitude = 1.0;
     unsigned int tx_sin_table_len = 4096;
 
     unsigned int rx_one = 0;
+    int stats = 0;
+    int events_fd = -1;
+    float rt_budget = 0;
+    int effort_min = 0;
+    int effort_max = RX_EFFORT_NLEVELS - 1;
+    int low_latency = 0;
     float rxnoise_factor = 0.0;
 
     int txcarrier = 0;
@@ -545,6 +912,16 @@ main( int argc, char*argv[] )
     int output_mode_binary = 0;
     int output_mode_raw_nbits = 0;
 
+    int batch_mode = 0;
+    unsigned int batch_njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char *batch_output_dir = NULL;
+
+    char *daemon_socket = NULL;
+    unsigned int daemon_njobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int raw = 0;
+    char *raw_format = NULL;
+
     float	bfsk_data_rate = 0.0;
     databits_encoder	*bfsk_databits_encode;
     databits_decoder	*bfsk_databits_decode;
@@ -552,101 +929,36 @@ main( int argc, char*argv[] )
     bfsk_databits_decode = databits_decode_ascii8;
     bfsk_databits_encode = databits_encode_ascii8;
 
-    /* validate the default system audio mechanism */
-#if !(USE_SNDIO || USE_PULSEAUDIO || USE_ALSA)
-# define _MINIMODEM_NO_SYSTEM_AUDIO
-# if !USE_SNDFILE
-#  error At least one of {USE_SNDIO,USE_PULSEAUDIO,USE_ALSA,USE_SNDFILE} must be enabled!
-# endif
-#endif
-
-    program_name = strrchr(argv[0], '/');
-    if ( program_name )
-	program_name++;
-    else
-	program_name = argv[0];
-
     int c;
     int option_index;
-    
-    enum {
-	MINIMODEM_OPT_UNUSED=256,	// placeholder
-	MINIMODEM_OPT_MSBFIRST,
-	MINIMODEM_OPT_STARTBITS,
-	MINIMODEM_OPT_STOPBITS,
-	MINIMODEM_OPT_INVERT_START_STOP,
-	MINIMODEM_OPT_SYNC_BYTE,
-	MINIMODEM_OPT_LUT,
-	MINIMODEM_OPT_FLOAT_SAMPLES,
-	MINIMODEM_OPT_RX_ONE,
-	MINIMODEM_OPT_BENCHMARKS,
-	MINIMODEM_OPT_BINARY_OUTPUT,
-	MINIMODEM_OPT_BINARY_RAW,
-	MINIMODEM_OPT_PRINT_FILTER,
-	MINIMODEM_OPT_XRXNOISE,
-	MINIMODEM_OPT_PRINT_EOT,
-	MINIMODEM_OPT_TXCARRIER
-    };
+
+    // start getopt over from scratch (a header is not the first argv)
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+    optreset = 1;
+#endif
 
     while ( 1 ) {
-	static struct option long_options[] = {
-	    { "version",	0, 0, 'V' },
-	    { "tx",		0, 0, 't' },
-	    { "transmit",	0, 0, 't' },
-	    { "write",		0, 0, 't' },
-	    { "rx",		0, 0, 'r' },
-	    { "receive",	0, 0, 'r' },
-	    { "read",		0, 0, 'r' },
-	    { "confidence",	1, 0, 'c' },
-	    { "limit",		1, 0, 'l' },
-	    { "auto-carrier",	0, 0, 'a' },
-	    { "inverted",	0, 0, 'i' },
-	    { "ascii",		0, 0, '8' },
-	    { "",		0, 0, '7' },
-	    { "baudot",		0, 0, '5' },
-	    { "usos",  		1, 0, 'u' },
-	    { "msb-first",	0, 0, MINIMODEM_OPT_MSBFIRST },
-	    { "file",		1, 0, 'f' },
-	    { "bandwidth",	1, 0, 'b' },
-	    { "volume",		1, 0, 'v' },
-	    { "mark",		1, 0, 'M' },
-	    { "space",		1, 0, 'S' },
-	    { "startbits",	1, 0, MINIMODEM_OPT_STARTBITS },
-	    { "stopbits",	1, 0, MINIMODEM_OPT_STOPBITS },
-	    { "invert-start-stop", 0, 0, MINIMODEM_OPT_INVERT_START_STOP },
-	    { "sync-byte",	1, 0, MINIMODEM_OPT_SYNC_BYTE },
-	    { "quiet",		0, 0, 'q' },
-	    { "alsa",		2, 0, 'A' },
-	    { "sndio",		2, 0, 's' },
-	    { "samplerate",	1, 0, 'R' },
-	    { "lut",		1, 0, MINIMODEM_OPT_LUT },
-	    { "float-samples",	0, 0, MINIMODEM_OPT_FLOAT_SAMPLES },
-	    { "rx-one",		0, 0, MINIMODEM_OPT_RX_ONE },
-	    { "benchmarks",	0, 0, MINIMODEM_OPT_BENCHMARKS },
-	    { "binary-output",	0, 0, MINIMODEM_OPT_BINARY_OUTPUT },
-	    { "binary-raw",	1, 0, MINIMODEM_OPT_BINARY_RAW },
-	    { "print-filter",	0, 0, MINIMODEM_OPT_PRINT_FILTER },
-	    { "print-eot",	0, 0, MINIMODEM_OPT_PRINT_EOT },
-	    { "Xrxnoise",	1, 0, MINIMODEM_OPT_XRXNOISE },
-	    { "tx-carrier",      0, 0, MINIMODEM_OPT_TXCARRIER },
-	    { 0 }
-	};
 	c = getopt_long(argc, argv, "Vtrc:l:ai875u:f:b:v:M:S:T:qs::A::R:",
 		long_options, &option_index);
 	if ( c == -1 )
 	    break;
+	if ( is_header && !option_is_per_stream(c) )
+	    return -1;
 	switch( c ) {
 	    case 'V':
 			version();
 			exit(0);
 	    case 't':
 			if ( TX_mode == 0 )
-			    usage();
+			    return -1;
 			TX_mode = 1;
 			break;
 	    case 'r':
 			if ( TX_mode == 1 )
-			    usage();
+			    return -1;
 			TX_mode = 0;
 			break;
 	    case 'c':
@@ -683,7 +995,8 @@ main( int argc, char*argv[] )
 			break;
 	    case 'b':
 			band_width = atof(optarg);
-			assert( band_width != 0 );
+			if ( band_width == 0 )
+			    return -1;
 			break;
 	    case 'v':
 			if ( optarg[0] == 'E' )
@@ -694,21 +1007,25 @@ main( int argc, char*argv[] )
 			break;
 	    case 'M':
 			bfsk_mark_f = atof(optarg);
-			assert( bfsk_mark_f > 0 );
+			if ( !(bfsk_mark_f > 0) )
+			    return -1;
 			break;
 	    case 'S':
 			bfsk_space_f = atof(optarg);
-			assert( bfsk_space_f > 0 );
+			if ( !(bfsk_space_f > 0) )
+			    return -1;
 			break;
 	    case MINIMODEM_OPT_STARTBITS:
 			bfsk_nstartbits = atoi(optarg);
 			// Note: bfsk_nstartbits is limited by arrays
 		        //   expect_bits_string[32] and fsk.c:bit_something[32]
-			assert( bfsk_nstartbits >= 0 && bfsk_nstartbits <= 20 );
+			if ( !(bfsk_nstartbits >= 0 && bfsk_nstartbits <= 20) )
+			    return -1;
 			break;
 	    case MINIMODEM_OPT_STOPBITS:
 			bfsk_nstopbits = atof(optarg);
-			assert( bfsk_nstopbits >= 0 );
+			if ( !(bfsk_nstopbits >= 0) )
+			    return -1;
 			break;
 	    case MINIMODEM_OPT_INVERT_START_STOP:
 			invert_start_stop = 1;
@@ -723,7 +1040,8 @@ main( int argc, char*argv[] )
 			break;
 	    case 'R':
 			sample_rate = atoi(optarg);
-			assert( sample_rate > 0 );
+			if ( sample_rate == 0 )
+			    return -1;
 			break;
 	    case 'A':
 #if USE_ALSA
@@ -776,27 +1094,103 @@ main( int argc, char*argv[] )
 	    case MINIMODEM_OPT_PRINT_EOT:
 			tx_print_eot = 1;
 			break;
+	    case MINIMODEM_OPT_BATCH:
+			batch_mode = 1;
+			break;
+	    case MINIMODEM_OPT_BATCH_JOBS:
+			batch_njobs = atoi(optarg);
+			assert( batch_njobs > 0 );
+			break;
+	    case MINIMODEM_OPT_BATCH_OUTPUT:
+			batch_output_dir = optarg;
+			break;
+	    case MINIMODEM_OPT_DAEMON:
+			daemon_socket = optarg;
+			break;
+	    case MINIMODEM_OPT_DAEMON_JOBS:
+			daemon_njobs = atoi(optarg);
+			assert( daemon_njobs > 0 );
+			break;
+	    case MINIMODEM_OPT_RAW:
+			raw = 1;
+			break;
+	    case MINIMODEM_OPT_RAW_FORMAT:
+			if ( strcmp(optarg, "s16") != 0
+				&& strcmp(optarg, "s24") != 0
+				&& strcmp(optarg, "s32") != 0
+				&& strcmp(optarg, "u8") != 0
+				&& strcmp(optarg, "float") != 0 ) {
+			    fprintf(stderr, "E: --raw-format takes s16, s24, s32, u8 or float.\n");
+			    return 1;
+			}
+			raw = 1;
+			raw_format = optarg;
+			break;
+	    case MINIMODEM_OPT_STATS:
+#if USE_STATS
+			stats = 1;
+			break;
+#else
+			fprintf(stderr, "E: this build of minimodem was configured without --stats support.\n");
+			return 1;
+#endif
+	    case MINIMODEM_OPT_RT_BUDGET:
+			rt_budget = atof(optarg);
+			if ( !(rt_budget > 0.0f) )
+			    return -1;
+			break;
+	    case MINIMODEM_OPT_RT_EFFORT:
+			if ( sscanf(optarg, "%d:%d", &effort_min, &effort_max) != 2
+				|| effort_min < 0 || effort_min > effort_max
+				|| effort_max >= RX_EFFORT_NLEVELS ) {
+			    fprintf(stderr, "E: --rt-effort takes {min}:{max}, within 0:%d.\n",
+				    RX_EFFORT_NLEVELS - 1);
+			    return 1;
+			}
+			break;
+	    case MINIMODEM_OPT_LOW_LATENCY:
+			low_latency = 1;
+			break;
+	    case MINIMODEM_OPT_EVENTS_FD:
+			events_fd = atoi(optarg);
+			if ( fcntl(events_fd, F_GETFD) < 0 ) {
+			    fprintf(stderr, "E: --events-fd %s: %s\n",
+				    optarg, strerror(errno));
+			    return 1;
+			}
+			break;
 	    default:
-			usage();
+			return -1;
 	}
     }
     if ( TX_mode == -1 )
 	TX_mode = 0;
 
-    /* The receive code requires floating point samples to feed to the FFT */
-    if ( TX_mode == 0 )
-	sample_format = SA_SAMPLE_FORMAT_FLOAT;
-
-    if ( filename ) {
-#if !USE_SNDFILE
-	fprintf(stderr, "E: This build of minimodem was configured without sndfile,\nE:   so the --file flag is not supported.\n");
-	exit(1);
-#endif
-    } else {
-#ifdef _MINIMODEM_NO_SYSTEM_AUDIO
-	fprintf(stderr, "E: this build of minimodem was configured without system audio support,\nE:   so only the --file mode is supported.\n");
-	exit(1);
-#endif
+    opts->TX_mode = TX_mode;
+    opts->filename = filename;
+    opts->sa_backend = sa_backend;
+    opts->sa_backend_device = sa_backend_device;
+    opts->sample_format = sample_format;
+    opts->sample_rate = sample_rate;
+    opts->tx_amplitude = tx_amplitude;
+    opts->tx_sin_table_len = tx_sin_table_len;
+    opts->rxnoise_factor = rxnoise_factor;
+    opts->txcarrier = txcarrier;
+    opts->batch_mode = batch_mode;
+    opts->batch_njobs = batch_njobs;
+    opts->batch_output_dir = batch_output_dir;
+    opts->daemon_socket = daemon_socket;
+    opts->daemon_njobs = daemon_njobs;
+    opts->raw = raw;
+    opts->raw_format = raw_format;
+
+    // the daemon takes its {baudmode} from each connection's header
+    if ( daemon_socket ) {
+	if ( optind != argc ) {
+	    fprintf(stderr, "E: --daemon takes {baudmode} from each connection, not the command line.\n");
+	    return -1;
+	}
+	return 0;
     }
 
 #if 0
@@ -808,12 +1202,13 @@ main( int argc, char*argv[] )
     }
 #endif
 
-    if (optind + 1 !=  argc) {
+    if ( batch_mode ? optind >= argc : optind + 1 != argc ) {
 	fprintf(stderr, "E: *** Must specify {baudmode} (try \"300\") ***\n");
-	usage();
+	return -1;
     }
 
     modem_mode = argv[optind++];
+    opts->argind = optind;
 
 
     if ( strncasecmp(modem_mode, "rtty",5)==0 ) {
@@ -884,8 +1279,8 @@ main( int argc, char*argv[] )
 	if ( bfsk_n_data_bits == 0 )
 	    bfsk_n_data_bits = 8;
     }
-    if ( bfsk_data_rate == 0.0f )
-	usage();
+    if ( !(bfsk_data_rate > 0.0f) )
+	return -1;
 
 
     if ( output_mode_binary || output_mode_raw_nbits )
@@ -943,13 +1338,9 @@ main( int argc, char*argv[] )
     unsigned int bfsk_frame_n_bits = bfsk_n_data_bits + bfsk_nstartbits + bfsk_nstopbits;
     if ( bfsk_frame_n_bits > 64 ) {
 	fprintf(stderr, "E: total number of bits per frame must be <= 64.\n");
-	exit(1);
+	return 1;
     }
 
-    // do not transmit any leader tone if no start bits
-    if ( bfsk_nstartbits == 0 )
-	tx_leader_bits_len = 0;
-
     if ( bfsk_inverted_freqs ) {
 	float t = bfsk_mark_f;
 	bfsk_mark_f = bfsk_space_f;
@@ -964,514 +1355,614 @@ main( int argc, char*argv[] )
     if ( fsk_confidence_search_limit < fsk_confidence_threshold )
 	fsk_confidence_search_limit = fsk_confidence_threshold;
 
-    char *stream_name = NULL;
+    opts->tx_sync_bytes = bfsk_do_tx_sync_bytes;
+    opts->databits_encode = bfsk_databits_encode;
+
+    receiver_config rx_config = {
+	.data_rate = bfsk_data_rate,
+	.mark_f = bfsk_mark_f,
+	.space_f = bfsk_space_f,
+	.band_width = band_width,
+	.n_data_bits = bfsk_n_data_bits,
+	.nstartbits = bfsk_nstartbits,
+	.nstopbits = bfsk_nstopbits,
+	.invert_start_stop = invert_start_stop,
+	.msb_first = bfsk_msb_first,
+	.do_rx_sync = bfsk_do_rx_sync,
+	.sync_byte = bfsk_sync_byte,
+	.expect_data_string = expect_data_string,
+	.expect_n_bits = expect_n_bits,
+	.inverted_freqs = bfsk_inverted_freqs,
+	.autodetect_shift = autodetect_shift,
+	.carrier_autodetect_threshold = carrier_autodetect_threshold,
+	.confidence_threshold = fsk_confidence_threshold,
+	.confidence_search_limit = fsk_confidence_search_limit,
+	.databits_decode = bfsk_databits_decode,
+	.output_print_filter = output_print_filter,
+	.rx_one = rx_one,
+	.quiet_mode = quiet_mode,
+	.stats = stats,
+	.events_fd = events_fd,
+	.rt_budget = rt_budget,
+	.effort_min = effort_min,
+	.effort_max = effort_max,
+	.low_latency = low_latency,
+    };
+    opts->rx = rx_config;
 
-    if ( filename ) {
-	sa_backend = SA_BACKEND_FILE;
-	stream_name = filename;
-    }
+    return 0;
+}
 
-    /*
-     * Handle transmit mode
-     */
-    if ( TX_mode ) {
+static int daemon_events_fd = -1;	// the daemon's own --events-fd
 
-	simpleaudio_tone_init(tx_sin_table_len, tx_amplitude);
+/* daemon_header_parser: a connection header is a receive command line */
+static int
+parse_daemon_header( int argc, char **argv, receiver_config *cfg,
+	unsigned int *sample_ratep, sa_format_t *sample_formatp )
+{
+    struct minimodem_options opts;
+    if ( parse_options(&opts, argc, argv, 1) != 0 )
+	return -1;
+    *cfg = opts.rx;
+    cfg->events_fd = daemon_events_fd;
+    *sample_ratep = opts.sample_rate;
+    *sample_formatp = opts.sample_format;
+    return 0;
+}
 
-	int tx_interactive = 0;
-	if ( ! stream_name ) {
-	    tx_interactive = 1;
-	    stream_name = "output audio";
-	}
 
-	simpleaudio *sa_out;
-	sa_out = simpleaudio_open_stream(sa_backend, sa_backend_device,
-					SA_STREAM_PLAYBACK,
-					sample_format, sample_rate, nchannels,
-					program_name, stream_name);
-	if ( ! sa_out )
-	    return 1;
+/*
+ * Receive benchmarks: synthesize a reproducible signal in memory for each
+ * {baudmode}, optionally with noise and clock skew, and time the whole
+ * receiver over it.
+ */
 
-	fsk_transmit_stdin(sa_out, tx_interactive,
-				bfsk_data_rate,
-				bfsk_mark_f, bfsk_space_f,
-				bfsk_n_data_bits,
-				bfsk_nstartbits,
-				bfsk_nstopbits,
-				invert_start_stop,
-				bfsk_msb_first,
-				bfsk_do_tx_sync_bytes,
-				bfsk_sync_byte,
-				bfsk_databits_encode,
-				txcarrier
-				);
+struct rx_bench_signal {
+	float		*samples;
+	size_t		nsamples;
+	size_t		nalloc;
+	double		sample_rate;
+	double		bit_nsamples;	// with clock skew
+	double		pos;		// fractional sample clock
+	double		phase;		// in turns
+};
 
-	simpleaudio_close(sa_out);
+static void
+rx_bench_tone( struct rx_bench_signal *sig, float freq, float nbits )
+{
+    sig->pos += sig->bit_nsamples * nbits;
+    size_t end = sig->pos + 0.5;
+    if ( end > sig->nalloc ) {
+	sig->nalloc = end * 2;
+	sig->samples = realloc(sig->samples, sig->nalloc * sizeof(float));
+	if ( !sig->samples ) {
+	    perror("malloc");
+	    exit(1);
+	}
+    }
+    double dphase = freq / sig->sample_rate;
+    for ( ; sig->nsamples<end; sig->nsamples++ ) {
+	sig->samples[sig->nsamples] = freq ? sinf(M_PI*2 * sig->phase) : 0.0f;
+	sig->phase += dphase;
+	if ( sig->phase >= 1.0 )
+	    sig->phase -= 1.0;
+    }
+}
 
-	return 0;
+static void
+rx_bench_frame( struct rx_bench_signal *sig, const receiver_config *cfg,
+	unsigned int bits, int msb_first )
+{
+    float mark_f = cfg->mark_f, space_f = cfg->space_f;
+    float start_f = cfg->invert_start_stop ? mark_f : space_f;
+    float stop_f = cfg->invert_start_stop ? space_f : mark_f;
+    unsigned int i;
+    if ( cfg->nstartbits > 0 )
+	rx_bench_tone(sig, start_f, cfg->nstartbits);
+    for ( i=0; i<cfg->n_data_bits; i++ ) {
+	unsigned int bit = msb_first ? bits >> (cfg->n_data_bits - i - 1)
+				     : bits >> i;
+	rx_bench_tone(sig, (bit & 1) ? mark_f : space_f, 1);
     }
+    if ( cfg->nstopbits > 0 )
+	rx_bench_tone(sig, stop_f, cfg->nstopbits);
+}
 
-    /*
-     * Open the input audio stream
-     */
+/* a cheap reproducible random number generator, [0.0 .. 1.0) */
+static double
+rx_bench_random( unsigned int *seedp )
+{
+    *seedp = *seedp * 1103515245 + 12345;
+    return (*seedp >> 8) / (double)(1 << 24);
+}
 
-    if ( ! stream_name )
-	stream_name = "input audio";
+struct rx_bench_output {
+	size_t		ndata;
+};
 
-    simpleaudio *sa;
-    sa = simpleaudio_open_stream(sa_backend, sa_backend_device,
-				SA_STREAM_RECORD,
-				sample_format, sample_rate, nchannels,
-				program_name, stream_name);
-    if ( ! sa )
-        return 1;
+static void
+rx_bench_output( void *arg, int is_report, const char *buf, size_t nbytes )
+{
+    struct rx_bench_output *out = arg;
+    if ( !is_report )
+	out->ndata += nbytes;
+}
 
-    sample_rate = simpleaudio_get_rate(sa);
+static void
+rx_benchmark( const char *mode, float noise_rms, float clock_skew )
+{
+    char *argv[] = { "minimodem", "--rx", "--quiet", (char *)mode, NULL };
+    struct minimodem_options opts;
+    if ( parse_options(&opts, 4, argv, 0) != 0 )
+	return;
+    receiver_config *cfg = &opts.rx;
+#if USE_STATS
+    cfg->stats = 1;
+#endif
 
-    if ( rxnoise_factor != 0.0f )
-	simpleaudio_set_rxnoise(sa, rxnoise_factor);
+    unsigned int sample_rate = 48000;
+    float audio_sec = 10.0f;
 
     /*
-     * Prepare the input sample chunk rate
+     * Synthesize the signal: leader, any sync bytes, then enough frames
+     * of pseudo-random data for audio_sec, then trailer.
      */
-    float nsamples_per_bit = sample_rate / bfsk_data_rate;
+    struct rx_bench_signal sig = {
+	.sample_rate = sample_rate,
+	.bit_nsamples = sample_rate / (cfg->data_rate * (1.0f + clock_skew)),
+    };
+    unsigned int seed = 1;
+    rx_bench_tone(&sig, 0, 0.1f * cfg->data_rate);	// 0.1 sec of silence
+    if ( cfg->nstartbits > 0 )
+	rx_bench_tone(&sig, cfg->invert_start_stop ? cfg->space_f : cfg->mark_f,
+			tx_leader_nbits(cfg));
+    unsigned int i, j;
+    for ( i=0; i<opts.tx_sync_bytes; i++ )
+	rx_bench_frame(&sig, cfg, cfg->sync_byte, 0);
+
+    float frame_n_bits = cfg->nstartbits + cfg->n_data_bits + cfg->nstopbits;
+    unsigned int nframes = audio_sec * cfg->data_rate / frame_n_bits;
+    int is_callerid = strncasecmp(mode, "caller", 6) == 0;
+    for ( i=0; i<nframes; ) {
+	if ( is_callerid ) {
+	    // SDMF messages: type, length, date/time, number, checksum
+	    const char *msg = "\x04\x12" "01020304" "5551234567" "\x00";
+	    for ( j=0; j<21; j++, i++ )
+		rx_bench_frame(&sig, cfg, (unsigned char)msg[j], cfg->msb_first);
+	    continue;
+	}
+	char c = ' ' + (int)(rx_bench_random(&seed) * 95);
+	if ( opts.databits_encode == databits_encode_baudot )
+	    c = "ETAOIN SHRDLU"[(int)(rx_bench_random(&seed) * 13)];
+	unsigned int bits[2];
+	unsigned int nwords = opts.databits_encode(bits, c);
+	for ( j=0; j<nwords; j++, i++ )
+	    rx_bench_frame(&sig, cfg, bits[j], cfg->msb_first);
+    }
+    nframes = i + opts.tx_sync_bytes;	// as actually sent
+    if ( cfg->nstartbits > 0 )
+	rx_bench_tone(&sig, cfg->invert_start_stop ? cfg->space_f : cfg->mark_f,
+			tx_trailer_bits_len);
+    rx_bench_tone(&sig, 0, 0.1f * cfg->data_rate);
+
+    if ( noise_rms > 0.0f ) {
+	for ( i=0; i<sig.nsamples; i+=2 ) {
+	    // Box-Muller: two gaussian samples per pair of uniform ones
+	    double u1 = 1.0 - rx_bench_random(&seed);
+	    double u2 = rx_bench_random(&seed);
+	    double r = noise_rms * sqrt(-2.0 * log(u1));
+	    sig.samples[i] += r * cos(M_PI*2 * u2);
+	    if ( i+1 < sig.nsamples )
+		sig.samples[i+1] += r * sin(M_PI*2 * u2);
+	}
+    }
 
+    fprintf(stdout, "  rx-%s%s%s\n", mode,
+	    noise_rms > 0.0f ? "-noise" : "",
+	    clock_skew != 0.0f ? "-skew" : "");
+    fflush(stdout);
 
     /*
-     * Prepare the fsk plan
+     * Decode it, fed in blocks as if from an audio device
      */
-
-    fsk_plan *fskp;
-    fskp = fsk_plan_new(sample_rate, bfsk_mark_f, bfsk_space_f, band_width);
+    fsk_plan *fskp = fsk_plan_new(sample_rate, cfg->mark_f, cfg->space_f,
+				cfg->band_width);
     if ( !fskp ) {
-        fprintf(stderr, "fsk_plan_new() failed\n");
-        return 1;
+	free(sig.samples);
+	return;
     }
+    struct rx_bench_output out = { 0 };
+    receiver *rx = receiver_new(cfg, fskp, sample_rate, -1, NULL);
+    if ( !rx ) {
+	fsk_plan_destroy(fskp);
+	free(sig.samples);
+	return;
+    }
+    receiver_set_output(rx, rx_bench_output, &out);
+
+    struct timeval tv_start, tv_stop;
+    gettimeofday(&tv_start, NULL);
+    size_t block_nsamples = sample_rate / 10;
+    for ( i=0; i<sig.nsamples; i+=block_nsamples ) {
+	size_t n = sig.nsamples - i;
+	if ( n > block_nsamples )
+	    n = block_nsamples;
+	if ( receiver_process(rx, sig.samples + i, n) )
+	    break;
+    }
+    receiver_finish(rx);
+    gettimeofday(&tv_stop, NULL);
+
+    unsigned long long runtime_usec, playtime_usec;
+    runtime_usec = (tv_stop.tv_sec - tv_start.tv_sec) * 1000000;
+    runtime_usec += tv_stop.tv_usec;
+    runtime_usec -= tv_start.tv_usec;
+    if ( runtime_usec == 0 )
+	runtime_usec = 1;
+    playtime_usec = sig.nsamples * 1000000ULL / sample_rate;
+
+    fprintf(stdout, "    audio playtime:  \t%2llu.%06llu sec\n",
+	    playtime_usec/1000000, playtime_usec%1000000);
+    fprintf(stdout, "    elapsed runtime: \t%2llu.%06llu sec\n",
+	    runtime_usec/1000000, runtime_usec%1000000);
+    fprintf(stdout, "    performance:     \t%llu samples/sec\n",
+	    sig.nsamples * 1000000ULL / runtime_usec);
+    fprintf(stdout, "    realtime factor: \t%.1fx\n",
+	    (double)playtime_usec / runtime_usec);
+    const struct receiver_stats *st = receiver_get_stats(rx);
+    if ( st ) {
+	unsigned long long nanalyses = st->search.frame_analyses
+					+ st->refine.frame_analyses;
+	fprintf(stdout, "    frames decoded:  \t%llu of %u\n",
+		st->frames_decoded, nframes);
+	fprintf(stdout, "    search per frame:\t%.1f frame analyses\n",
+		st->frames_decoded ?
+		    (double)nanalyses / st->frames_decoded : 0.0);
+    } else {
+	fprintf(stdout, "    data decoded:    \t%zu bytes (of %u frames)\n",
+		out.ndata, nframes);
+    }
+    fflush(stdout);
 
-    /*
-     * Prepare the input sample buffer.  For 8-bit frames with prev/start/stop
-     * we need 11 data-bits worth of samples, and we will scan through one bits
-     * worth at a time, hence we need a minimum total input buffer size of 12
-     * data-bits.  */
-    unsigned int nbits = 0;
-    nbits += 1;			// prev stop bit (last whole stop bit)
-    nbits += bfsk_nstartbits;	// start bits
-    nbits += bfsk_n_data_bits;
-    nbits += 1;			// stop bit (first whole stop bit)
-
-    // FIXME EXPLAIN +1 goes with extra bit when scanning
-    size_t	samplebuf_size = ceilf(nsamples_per_bit) * (nbits+1);
-    samplebuf_size *= 2; // account for the half-buf filling method
-#define SAMPLE_BUF_DIVISOR 12
-#ifdef SAMPLE_BUF_DIVISOR
-    // For performance, use a larger samplebuf_size than necessary
-    if ( samplebuf_size < sample_rate / SAMPLE_BUF_DIVISOR )
-	samplebuf_size = sample_rate / SAMPLE_BUF_DIVISOR;
-#endif
-    float	*samplebuf = malloc(samplebuf_size * sizeof(float));
-    size_t	samples_nvalid = 0;
-    debug_log("samplebuf_size=%zu\n", samplebuf_size);
-
-    /*
-     * Run the main loop
-     */
+    receiver_destroy(rx);
+    fsk_plan_destroy(fskp);
+    free(sig.samples);
+}
 
-    int			ret = 0;
-
-    int			carrier = 0;
-    float		confidence_total = 0;
-    float		amplitude_total = 0;
-    unsigned int	nframes_decoded = 0;
-    size_t		carrier_nsamples = 0;
-
-    unsigned int	noconfidence = 0;
-    unsigned int	advance = 0;
-
-    // Fraction of nsamples_per_bit that we will "overscan"; range (0.0 .. 1.0)
-    float fsk_frame_overscan = 0.5;
-    //   should be != 0.0 (only the nyquist edge cases actually require this?)
-    // for handling of slightly faster-than-us rates:
-    //   should be >> 0.0 to allow us to lag back for faster-than-us rates
-    //   should be << 1.0 or we may lag backwards over whole bits
-    // for optimal analysis:
-    //   should be >= 0.5 (half a bit width) or we may not find the optimal bit
-    //   should be <  1.0 (a full bit width) or we may skip over whole bits
-    // for encodings without start/stop bits:
-    //     MUST be <= 0.5 or we may accidentally skip a bit
-    //
-    assert( fsk_frame_overscan >= 0.0f && fsk_frame_overscan < 1.0f );
-
-    // ensure that we overscan at least a single sample
-    unsigned int nsamples_overscan
-			= nsamples_per_bit * fsk_frame_overscan + 0.5f;
-    if ( fsk_frame_overscan > 0.0f && nsamples_overscan == 0 )
-	nsamples_overscan = 1;
-    debug_log("fsk_frame_overscan=%f nsamples_overscan=%u\n",
-	    fsk_frame_overscan, nsamples_overscan);
-
-    float frame_n_bits = bfsk_frame_n_bits;
-    unsigned int frame_nsamples = nsamples_per_bit * frame_n_bits + 0.5f;
-
-    char expect_data_string_buffer[64];
-    if (expect_data_string == NULL) {
-        expect_data_string = expect_data_string_buffer;
-        expect_n_bits = build_expect_bits_string(expect_data_string, bfsk_nstartbits, bfsk_n_data_bits, bfsk_nstopbits, invert_start_stop, 0, 0);
+static void
+rx_benchmarks()
+{
+    const char *modes[] = { "300", "1200", "12000", "rtty", "same", "callerid" };
+    unsigned int i;
+    for ( i=0; i<sizeof(modes)/sizeof(modes[0]); i++ ) {
+	rx_benchmark(modes[i], 0.0f, 0.0f);
+	rx_benchmark(modes[i], 0.3f, 0.01f);	// ~7 dB SNR, 1% fast
     }
-    debug_log("eds = '%s' (%lu)\n", expect_data_string, strlen(expect_data_string));
+}
 
-    char expect_sync_string_buffer[64];
-    if (expect_sync_string == NULL && bfsk_do_rx_sync && (long long) bfsk_sync_byte >= 0) {
-        expect_sync_string = expect_sync_string_buffer;
-        build_expect_bits_string(expect_sync_string, bfsk_nstartbits, bfsk_n_data_bits, bfsk_nstopbits, invert_start_stop, 1, bfsk_sync_byte);
-    } else {
-	expect_sync_string = expect_data_string;
-    }
-    debug_log("ess = '%s' (%lu)\n", expect_sync_string, strlen(expect_sync_string));
 
-	unsigned int expect_nsamples = nsamples_per_bit * expect_n_bits;
-    float track_amplitude = 0.0;
-    float peak_confidence = 0.0;
+/*
+ * TX benchmark: push audio_sec worth of pseudo-random text for the mode
+ * through fsk_transmit_stdin() (reading it from a temporary file as its
+ * stdin) into the benchmark backend, i.e. encoding, framing, synthesis
+ * and the writer thread.
+ */
+static void
+tx_benchmark( const char *mode )
+{
+    char *argv[] = { "minimodem", "--tx", (char *)mode, NULL };
+    struct minimodem_options opts;
+    if ( parse_options(&opts, 3, argv, 0) != 0 )
+	return;
+    receiver_config *cfg = &opts.rx;
 
-    signal(SIGINT, rx_stop_sighandler);
+    float audio_sec = 600.0f;
+    float frame_n_bits = cfg->nstartbits + cfg->n_data_bits + cfg->nstopbits;
+    unsigned int nchars = audio_sec * cfg->data_rate / frame_n_bits;
 
-    while ( 1 ) {
+    FILE *text = tmpfile();
+    if ( !text ) {
+	perror("tmpfile");
+	return;
+    }
+    unsigned int seed = 1, i;
+    for ( i=0; i<nchars; i++ ) {
+	char c = ' ' + (int)(rx_bench_random(&seed) * 95);
+	if ( opts.databits_encode == databits_encode_baudot )
+	    c = "ETAOIN SHRDLU"[(int)(rx_bench_random(&seed) * 13)];
+	fputc(c, text);
+    }
+    fflush(text);
+    rewind(text);
+
+    simpleaudio_tone_init(opts.tx_sin_table_len, opts.tx_amplitude);
+    char stream_name[64];
+    snprintf(stream_name, sizeof(stream_name), "tx-%s", mode);
+    simpleaudio *sa_out = simpleaudio_open_stream(SA_BACKEND_BENCHMARK, NULL,
+			SA_STREAM_PLAYBACK, opts.sample_format,
+			opts.sample_rate, 1, program_name, stream_name);
+    if ( !sa_out ) {
+	fclose(text);
+	return;
+    }
 
-	if ( rx_stop )
-	    break;
+    int saved_stdin = dup(0);
+    dup2(fileno(text), 0);
+    tx_buf_release();
+
+    struct timeval tv_start, tv_stop;
+    gettimeofday(&tv_start, NULL);
+    if ( fsk_transmit_stdin(sa_out, 0, cfg->data_rate, cfg->mark_f, cfg->space_f,
+			cfg->n_data_bits, cfg->nstartbits, cfg->nstopbits,
+			cfg->invert_start_stop, cfg->msb_first,
+			opts.tx_sync_bytes, cfg->sync_byte,
+			tx_leader_nbits(cfg),
+			opts.databits_encode, 0) < 0 )
+	fprintf(stderr, "E: tx benchmark: write failed\n");
+    gettimeofday(&tv_stop, NULL);
+
+    dup2(saved_stdin, 0);
+    close(saved_stdin);
+    fclose(text);
+
+    unsigned long long allocs = tx_buf.allocs + sa_tone_generator_get_nallocs(
+				simpleaudio_get_tone_generator(sa_out));
+    simpleaudio_close(sa_out);	// reports samples/sec
+
+    unsigned long long runtime_usec;
+    runtime_usec = (tv_stop.tv_sec - tv_start.tv_sec) * 1000000;
+    runtime_usec += tv_stop.tv_usec;
+    runtime_usec -= tv_start.tv_usec;
+    if ( runtime_usec == 0 )
+	runtime_usec = 1;
+    fprintf(stdout, "    frames sent:     \t%llu\n", tx_buf.frames);
+    fprintf(stdout, "    frames/sec:      \t%llu\n",
+	    tx_buf.frames * 1000000ULL / runtime_usec);
+    fprintf(stdout, "    buffer allocs:   \t%llu (%.6f per frame; tx buffer and tone templates)\n",
+	    allocs, tx_buf.frames ? (double)allocs / tx_buf.frames : 0.0);
+    fflush(stdout);
 
-	debug_log("advance=%u\n", advance);
+    tx_buf_release();
+}
 
-	/* Shift the samples in samplebuf by 'advance' samples */
-	assert( advance <= samplebuf_size );
-	if ( advance == samplebuf_size ) {
-	    samples_nvalid = 0;
-	    advance = 0;
-	}
-	if ( advance ) {
-	    if ( advance > samples_nvalid )
-		break;
-	    memmove(samplebuf, samplebuf+advance,
-		    (samplebuf_size-advance)*sizeof(float));
-	    samples_nvalid -= advance;
-	}
+static void
+tx_benchmarks()
+{
+    const char *modes[] = { "300", "1200", "12000", "rtty", "tdd", "same" };
+    unsigned int i;
+    for ( i=0; i<sizeof(modes)/sizeof(modes[0]); i++ )
+	tx_benchmark(modes[i]);
+}
 
-	if ( samples_nvalid < samplebuf_size/2 ) {
-	    float	*samples_readptr = samplebuf + samples_nvalid;
-	    size_t	read_nsamples = samplebuf_size/2;
-	    /* Read more samples into samplebuf (fill it) */
-	    assert ( read_nsamples > 0 );
-	    assert ( samples_nvalid + read_nsamples <= samplebuf_size );
-	    ssize_t r;
-	    r = simpleaudio_read(sa, samples_readptr, read_nsamples);
-	    debug_log("simpleaudio_read(samplebuf+%td, n=%zu) returns %zd\n",
-		    samples_readptr - samplebuf, read_nsamples, r);
-	    if ( r < 0 ) {
-		fprintf(stderr, "simpleaudio_read: error\n");
-		ret = -1;
-		break;
-	    }
-	    samples_nvalid += r;
-	}
 
-	if ( samples_nvalid == 0 )
-	    break;
+int
+main( int argc, char*argv[] )
+{
+    struct minimodem_options opts;
+    unsigned int nchannels = 1; // FIXME: only works with one channel
 
-	/* Auto-detect carrier frequency */
-	static int carrier_band = -1;
-	if ( carrier_autodetect_threshold > 0.0f && carrier_band < 0 ) {
-	    unsigned int i;
-	    float nsamples_per_scan = nsamples_per_bit;
-	    if ( nsamples_per_scan > fskp->fftsize )
-		nsamples_per_scan = fskp->fftsize;
-	    for ( i=0; i+nsamples_per_scan<=samples_nvalid;
-						 i+=nsamples_per_scan ) {
-		carrier_band = fsk_detect_carrier(fskp,
-				    samplebuf+i, nsamples_per_scan,
-				    carrier_autodetect_threshold);
-		if ( carrier_band >= 0 )
-		    break;
-	    }
-	    advance = i + nsamples_per_scan;
-	    if ( advance > samples_nvalid )
-		advance = samples_nvalid;
-	    if ( carrier_band < 0 ) {
-		debug_log("autodetected carrier band not found\n");
-		continue;
-	    }
+    /* validate the default system audio mechanism */
+#if !(USE_SNDIO || USE_PULSEAUDIO || USE_ALSA)
+# define _MINIMODEM_NO_SYSTEM_AUDIO
+# if !USE_SNDFILE
+#  error At least one of {USE_SNDIO,USE_PULSEAUDIO,USE_ALSA,USE_SNDFILE} must be enabled!
+# endif
+#endif
 
-	    // default negative shift -- reasonable?
-	    int b_shift = - (float)(autodetect_shift + fskp->band_width/2.0f)
-						/ fskp->band_width;
-	    if ( bfsk_inverted_freqs )
-		b_shift *= -1;
-	    /* only accept a carrier as b_mark if it will not result
-	     * in a b_space band which is "too low". */
-	    int b_space = carrier_band + b_shift;
-	    if ( b_space < 1 || b_space >= fskp->nbands ) {
-		debug_log("autodetected space band out of range\n" );
-		carrier_band = -1;
-		continue;
-	    }
+    program_name = strrchr(argv[0], '/');
+    if ( program_name )
+	program_name++;
+    else
+	program_name = argv[0];
 
-	    debug_log("### TONE freq=%.1f ###\n",
-		    carrier_band * fskp->band_width);
+    int r = parse_options(&opts, argc, argv, 0);
+    if ( r < 0 )
+	usage();
+    if ( r > 0 )
+	return 1;
 
-	    fsk_set_tones_by_bandshift(fskp, /*b_mark*/carrier_band, b_shift);
-	}
+    int TX_mode = opts.TX_mode;
+    char *filename = opts.filename;
+    receiver_config *rx_config = &opts.rx;
 
-	/*
-	 * The main processing algorithm: scan samplesbuf for FSK frames,
-	 * looking at an entire frame at once.
-	 */
+    // --raw puts S16 (or with --float-samples, float) samples on the wire
+    sa_format_t raw_format = opts.sample_format;
 
-	debug_log( "--------------------------\n");
+    /* The receive code requires floating point samples to feed to the FFT */
+    if ( TX_mode == 0 )
+	opts.sample_format = SA_SAMPLE_FORMAT_FLOAT;
 
-	if ( samples_nvalid < expect_nsamples )
-	    break;
+    if ( opts.raw && (opts.daemon_socket || opts.batch_mode) ) {
+	fprintf(stderr, "E: --raw does not apply to --daemon or --batch.\n");
+	exit(1);
+    }
 
-	// try_max_nsamples
-	// serves two purposes
-	// 1. avoids finding a non-optimal first frame
-	// 2. allows us to track slightly slow signals
-	unsigned int try_max_nsamples;
-	if ( carrier )
-	    try_max_nsamples = nsamples_per_bit * 0.75f + 0.5f;
-	else
-	    try_max_nsamples = nsamples_per_bit;
-	try_max_nsamples += nsamples_overscan;
-
-	// FSK_ANALYZE_NSTEPS Try 3 frame positions across the try_max_nsamples
-	// range.  Using a larger nsteps allows for more accurate tracking of
-	// fast/slow signals (at decreased performance).  Note also
-	// FSK_ANALYZE_NSTEPS_FINE below, which refines the frame
-	// position upon first acquiring carrier, or if confidence falls.
-#define FSK_ANALYZE_NSTEPS		3
-	unsigned int try_step_nsamples = try_max_nsamples / FSK_ANALYZE_NSTEPS;
-	if ( try_step_nsamples == 0 )
-	    try_step_nsamples = 1;
-
-	float confidence, amplitude;
-	unsigned long long bits = 0;
-	/* Note: frame_start_sample is actually the sample where the
-	 * prev_stop bit begins (since the "frame" includes the prev_stop). */
-	unsigned int frame_start_sample = 0;
-
-	unsigned int try_first_sample;
-	float try_confidence_search_limit;
-
-	try_confidence_search_limit = fsk_confidence_search_limit;
-	try_first_sample = carrier ? nsamples_overscan : 0;
-
-	confidence = fsk_find_frame(fskp, samplebuf, expect_nsamples,
-			try_first_sample,
-			try_max_nsamples,
-			try_step_nsamples,
-			try_confidence_search_limit,
-			carrier ? expect_data_string : expect_sync_string,
-			&bits,
-			&amplitude,
-			&frame_start_sample
-			);
-
-	int do_refine_frame = 0;
-
-	if ( confidence < peak_confidence * 0.75f ) {
-	    do_refine_frame = 1;
-	    debug_log(" ... do_refine_frame rescan (confidence %.3f << %.3f peak)\n", confidence, peak_confidence);
-	    peak_confidence = 0;
+    if ( opts.daemon_socket ) {
+	if ( TX_mode || filename || opts.batch_mode ) {
+	    fprintf(stderr, "E: --daemon applies to --rx mode only, without --file or --batch.\n");
+	    exit(1);
 	}
-
-	// no-confidence if amplitude drops abruptly to < 25% of the
-	// track_amplitude, which follows amplitude with hysteresis
-	if ( amplitude < track_amplitude * 0.25f ) {
-	    confidence = 0;
+	daemon_events_fd = rx_config->events_fd;
+	return daemon_serve(opts.daemon_socket, opts.daemon_njobs,
+				parse_daemon_header);
+    } else if ( opts.batch_mode ) {
+	if ( TX_mode ) {
+	    fprintf(stderr, "E: --batch applies to --rx mode only.\n");
+	    exit(1);
 	}
+	if ( filename ) {
+	    fprintf(stderr, "E: --batch takes its input files as arguments (or on stdin), not --file.\n");
+	    exit(1);
+	}
+#if !USE_SNDFILE
+	fprintf(stderr, "E: This build of minimodem was configured without sndfile,\nE:   so the --batch flag is not supported.\n");
+	exit(1);
+#endif
+    } else if ( opts.raw ) {
+	// raw PCM needs neither sndfile nor system audio
+    } else if ( filename ) {
+#if !USE_SNDFILE
+	fprintf(stderr, "E: This build of minimodem was configured without sndfile,\nE:   so the --file flag is not supported.\n");
+	exit(1);
+#endif
+    } else {
+#ifdef _MINIMODEM_NO_SYSTEM_AUDIO
+	fprintf(stderr, "E: this build of minimodem was configured without system audio support,\nE:   so only the --file mode is supported.\n");
+	exit(1);
+#endif
+    }
 
-#define FSK_MAX_NOCONFIDENCE_BITS	20
+    sa_backend_t sa_backend = opts.sa_backend;
+    char *sa_backend_device = opts.sa_backend_device;
+    char *stream_name = NULL;
+    char raw_device[4096];
+
+    if ( opts.raw ) {
+	sa_backend = SA_BACKEND_RAW;
+	stream_name = filename ? filename : TX_mode ? "stdout" : "stdin";
+	snprintf(raw_device, sizeof(raw_device), "%s:%s",
+		opts.raw_format ? opts.raw_format :
+		raw_format == SA_SAMPLE_FORMAT_FLOAT ? "float" : "s16",
+		filename ? filename : "-");
+	sa_backend_device = raw_device;
+    } else if ( filename ) {
+	sa_backend = SA_BACKEND_FILE;
+	stream_name = filename;
+    }
 
-	if ( confidence <= fsk_confidence_threshold ) {
+    /*
+     * Handle transmit mode
+     */
+    if ( TX_mode ) {
 
-	    // FIXME: explain
-	    if ( ++noconfidence > FSK_MAX_NOCONFIDENCE_BITS )
-	    {
-		carrier_band = -1;
-		if ( carrier ) {
-		    if ( !quiet_mode )
-			report_no_carrier(fskp, sample_rate, bfsk_data_rate,
-			    frame_n_bits, nframes_decoded,
-			    carrier_nsamples, confidence_total, amplitude_total);
-		    carrier = 0;
-		    carrier_nsamples = 0;
-		    confidence_total = 0;
-		    amplitude_total = 0;
-		    nframes_decoded = 0;
-		    track_amplitude = 0.0;
-
-		    if ( rx_one )
-			break;
-		}
-	    }
+	simpleaudio_tone_init(opts.tx_sin_table_len, opts.tx_amplitude);
 
-	    /* Advance the sample stream forward by try_max_nsamples so the
-	     * next time around the loop we continue searching from where
-	     * we left off this time.		*/
-	    advance = try_max_nsamples;
-	    debug_log("@ NOCONFIDENCE=%u advance=%u\n", noconfidence, advance);
-	    continue;
+	int tx_interactive = 0;
+	if ( ! stream_name ) {
+	    tx_interactive = 1;
+	    stream_name = "output audio";
 	}
 
-	// Add a frame's worth of samples to the sample count
-	carrier_nsamples += frame_nsamples;
+	simpleaudio *sa_out = NULL;
 
-	if ( carrier ) {
-
-	    // If we already had carrier, adjust sample count +start -overscan
-	    carrier_nsamples += frame_start_sample;
-	    carrier_nsamples -= nsamples_overscan;
-
-	} else {
-
-	    // We just acquired carrier.
-
-	    if ( !quiet_mode ) {
-		if ( bfsk_data_rate >= 100 )
-		    fprintf(stderr, "### CARRIER %u @ %.1f Hz ",
-			    (unsigned int)(bfsk_data_rate + 0.5f),
-			    (double)(fskp->b_mark * fskp->band_width));
-		else
-		    fprintf(stderr, "### CARRIER %.2f @ %.1f Hz ",
-			    (double)(bfsk_data_rate),
-			    (double)(fskp->b_mark * fskp->band_width));
-	    }
+	/* Write uncompressed output files directly, not through sndfile */
+	if ( filename && ! opts.raw )
+	    sa_out = simpleaudio_open_stream(SA_BACKEND_WAV, filename,
+					SA_STREAM_PLAYBACK,
+					opts.sample_format, opts.sample_rate,
+					nchannels, program_name, stream_name);
+	if ( ! sa_out )
+	    sa_out = simpleaudio_open_stream(sa_backend, sa_backend_device,
+					SA_STREAM_PLAYBACK,
+					opts.sample_format, opts.sample_rate,
+					nchannels, program_name, stream_name);
+	if ( ! sa_out )
+	    return 1;
 
-	    if ( !quiet_mode )
-		fprintf(stderr, "###\n");
+	int tx_ret = fsk_transmit_stdin(sa_out, tx_interactive,
+				rx_config->data_rate,
+				rx_config->mark_f, rx_config->space_f,
+				rx_config->n_data_bits,
+				rx_config->nstartbits,
+				rx_config->nstopbits,
+				rx_config->invert_start_stop,
+				rx_config->msb_first,
+				opts.tx_sync_bytes,
+				rx_config->sync_byte,
+				tx_leader_nbits(rx_config),
+				opts.databits_encode,
+				opts.txcarrier
+				);
+	if ( simpleaudio_drain(sa_out) < 0 )
+	    tx_ret = -1;
 
-	    carrier = 1;
-	    bfsk_databits_decode(0, 0, 0, 0); // reset the frame processor
+	if ( rx_config->stats )
+	    fprintf(stderr, "### STATS tx frames=%llu samples=%llu"
+			" writes=%llu buffer_allocs=%llu write_waits=%llu"
+			" underruns=%lu ###\n",
+		    tx_buf.frames, tx_buf.samples, tx_buf.writes, tx_buf.allocs,
+		    tx_buf.write_waits, simpleaudio_get_underruns(sa_out));
 
-	    do_refine_frame = 1;
-	    debug_log(" ... do_refine_frame rescan (acquired carrier)\n");
-	}
+	simpleaudio_close(sa_out);
 
-	if ( do_refine_frame )
-	{
-	    if ( confidence < INFINITY && try_step_nsamples > 1 ) {
-		// FSK_ANALYZE_NSTEPS_FINE:
-		// Scan again, but try harder to find the best frame.
-		// Since we found a valid confidence frame in the "sloppy"
-		// fsk_find_frame() call already, we're sure to find one at
-		// least as good this time.
-#define FSK_ANALYZE_NSTEPS_FINE		8
-		try_step_nsamples = try_max_nsamples / FSK_ANALYZE_NSTEPS_FINE;
-		if ( try_step_nsamples == 0 )
-		    try_step_nsamples = 1;
-		try_confidence_search_limit = INFINITY;
-		float confidence2, amplitude2;
-		unsigned long long bits2;
-		unsigned int frame_start_sample2;
-		confidence2 = fsk_find_frame(fskp, samplebuf, expect_nsamples,
-			    try_first_sample,
-			    try_max_nsamples,
-			    try_step_nsamples,
-			    try_confidence_search_limit,
-			    carrier ? expect_data_string : expect_sync_string,
-			    &bits2,
-			    &amplitude2,
-			    &frame_start_sample2
-			    );
-		if ( confidence2 > confidence ) {
-		    bits = bits2;
-		    amplitude = amplitude2;
-		    frame_start_sample = frame_start_sample2;
-		}
-	    }
+	if ( tx_ret < 0 ) {
+	    fprintf(stderr, "E: writing %s failed\n", stream_name);
+	    return 1;
 	}
+	return 0;
+    }
 
-	track_amplitude = ( track_amplitude + amplitude ) / 2;
-	if ( peak_confidence < confidence )
-	    peak_confidence = confidence;
-	debug_log("@ confidence=%.3f peak_conf=%.3f amplitude=%.3f track_amplitude=%.3f\n",
-		confidence, peak_confidence, amplitude, track_amplitude );
+    if ( rx_config->stats )
+	signal(SIGUSR1, rx_stats_sighandler);
 
-	confidence_total += confidence;
-	amplitude_total += amplitude;
-	nframes_decoded++;
-	noconfidence = 0;
+    if ( opts.batch_mode )
+	return batch_receive(rx_config, argv+opts.argind, argc-opts.argind,
+				opts.batch_njobs, opts.batch_output_dir,
+				program_name);
 
-	// Advance the sample stream forward past the junk before the
-	// frame starts (frame_start_sample), and then past decoded frame
-	// (see also NOTE about frame_n_bits and expect_n_bits)...
-	// But actually advance just a bit less than that to allow
-	// for tracking slightly fast signals, hence - nsamples_overscan.
-	advance = frame_start_sample + frame_nsamples - nsamples_overscan;
+    /*
+     * Open the input audio stream
+     */
 
-	debug_log("@ nsamples_per_bit=%.3f n_data_bits=%u "
-			" frame_start=%u advance=%u\n",
-		    nsamples_per_bit, bfsk_n_data_bits,
-		    frame_start_sample, advance);
+    if ( ! stream_name )
+	stream_name = "input audio";
 
-	// chop off the prev_stop bit
-	if ( bfsk_nstopbits != 0.0f )
-	    bits = bits >> 1;
+    // don't let the audio system sit on more than a few bits of input
+    if ( rx_config->low_latency )
+	simpleaudio_set_latency(RX_LOW_LATENCY_US);
 
+    simpleaudio *sa = NULL;
 
-	/*
-	 * Send the raw data frame bits to the backend frame processor
-	 * for final conversion to output data bytes.
-	 */
+    /* Read uncompressed input files in place if we can (but the mmap
+     * backend does not simulate --Xrxnoise) */
+    if ( filename && opts.rxnoise_factor == 0.0f )
+	sa = simpleaudio_open_stream(SA_BACKEND_MMAP,
+				opts.raw ? sa_backend_device : filename,
+				SA_STREAM_RECORD,
+				opts.sample_format, opts.sample_rate, nchannels,
+				program_name, stream_name);
+    if ( ! sa )
+	sa = simpleaudio_open_stream(sa_backend, sa_backend_device,
+				SA_STREAM_RECORD,
+				opts.sample_format, opts.sample_rate, nchannels,
+				program_name, stream_name);
+    if ( ! sa )
+        return 1;
 
-	// chop off framing bits
-	bits = bit_window(bits, bfsk_nstartbits, bfsk_n_data_bits);
-	if (bfsk_msb_first) {
-		bits = bit_reverse(bits, bfsk_n_data_bits);
-	}
-	debug_log("Input: %08x%08x - Databits: %u - Shift: %i\n", (unsigned int)(bits >> 32), (unsigned int)bits, bfsk_n_data_bits, bfsk_nstartbits);
+    unsigned int sample_rate = simpleaudio_get_rate(sa);
 
-	unsigned int dataout_size = 4096;
-	char dataoutbuf[4096];
-	unsigned int dataout_nbytes = 0;
+    if ( opts.rxnoise_factor != 0.0f )
+	simpleaudio_set_rxnoise(sa, opts.rxnoise_factor);
 
-	// suppress printing of bfsk_sync_byte bytes
-	if ( bfsk_do_rx_sync ) {
-	    if ( dataout_nbytes == 0 && bits == bfsk_sync_byte )
-		continue;
-	}
+    /*
+     * Prepare the fsk plan
+     */
 
-	dataout_nbytes += bfsk_databits_decode(dataoutbuf + dataout_nbytes,
-						dataout_size - dataout_nbytes,
-						bits, (int)bfsk_n_data_bits);
+    fsk_plan *fskp;
+    fskp = fsk_plan_new(sample_rate, rx_config->mark_f, rx_config->space_f,
+				rx_config->band_width);
+    if ( !fskp ) {
+        fprintf(stderr, "fsk_plan_new() failed\n");
+        return 1;
+    }
 
-	if ( dataout_nbytes == 0 )
-	    continue;
+    receiver *rx;
+    rx = receiver_new(rx_config, fskp, sample_rate, 1, stderr);
+    if ( !rx )
+	return 1;
+    receiver_set_stream_name(rx, stream_name);
 
-	/*
-	 * Print the output buffer to stdout
-	 */
-	if ( output_print_filter == 0 ) {
-	    if ( write(1, dataoutbuf, dataout_nbytes) < 0 )
-		perror("write");
-	} else {
-	    char *p = dataoutbuf;
-	    for ( ; dataout_nbytes; p++,dataout_nbytes-- ) {
-		char printable_char = isprint(*p)||isspace(*p) ? *p : '.';
-		if ( write(1, &printable_char, 1) < 0 )
-		    perror("write");
-	    }
-	}
+    /*
+     * Run the main loop
+     */
 
-    } /* end of the main loop */
+    signal(SIGINT, rx_stop_sighandler);
 
-    free(samplebuf);
+    int ret = receiver_read_audio(rx, sa, &rx_stop);
 
     signal(SIGINT, SIG_DFL);
 
-    if ( carrier ) {
-	if ( !quiet_mode )
-	    report_no_carrier(fskp, sample_rate, bfsk_data_rate,
-		frame_n_bits, nframes_decoded,
-		carrier_nsamples, confidence_total, amplitude_total);
-    }
+    receiver_destroy(rx);
 
     simpleaudio_close(sa);
 
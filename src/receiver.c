@@ -0,0 +1,1332 @@
+/*
+ * receiver.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#include <assert.h>
+
+#include "receiver.h"
+#include "stats.h"
+
+
+volatile sig_atomic_t receiver_stats_requested;
+
+
+#define RX_ARRIVALS	8	// a frame arrives over at most a few reads
+
+struct receiver {
+	receiver_config	cfg;
+	fsk_plan	*fskp;
+	unsigned int	sample_rate;
+	int		out_fd;
+	FILE		*report_fp;
+	receiver_output_fn *output_fn;
+	void		*output_arg;
+	databits_state	databits_state;
+	struct receiver_stats stats;
+	struct receiver_stats *statsp;	// NULL unless cfg.stats
+	char		*stream_name;	// for the events stream
+	unsigned long long input_nsamples;
+	unsigned long long cpu_ns;	// spent in receiver_run (if events)
+
+	float		nsamples_per_bit;
+	unsigned int	nsamples_overscan;
+	float		frame_n_bits;
+	unsigned int	frame_nsamples;
+	unsigned int	expect_nsamples;
+	char		expect_data_string[64];
+	char		expect_sync_string[64];
+
+	float		*samplebuf;
+	size_t		samplebuf_size;
+	size_t		samples_nvalid;
+	unsigned int	advance;
+	const float	*window;	// samplebuf, or a view into mapped input
+	unsigned long long window_pos;	// stream offset of window[0]
+
+	const float	*mapped;	// whole input stream, if read in place
+	size_t		mapped_nsamples;
+	size_t		mapped_pos;	// window == mapped + mapped_pos
+	size_t		mapped_nread;	// how much went into samplebuf on unmap
+
+	/* idle gate: tone and total energy of the window, by chunks */
+	unsigned int	gate_chunk_nsamples;	// 0 if the gate is disabled
+	unsigned int	gate_nchunks;		// chunks measured so far
+	float		*gate_tone;
+	float		*gate_energy;
+	size_t		idle_nsamples_skipped;
+
+	int		reading;	// waiting for a half-buffer of input
+	size_t		read_nsamples;	// ... of which we have this many
+	int		eof;
+	int		done;
+
+	int		carrier;
+	int		carrier_band;
+	unsigned long long carrier_start;	// stream offset of the 1st frame
+	unsigned int	ncarriers;
+	float		confidence_total;
+	float		amplitude_total;
+	unsigned int	nframes_decoded;
+	size_t		carrier_nsamples;
+	unsigned int	noconfidence;
+	float		track_amplitude;
+	float		peak_confidence;
+
+	/* search effort, and the --rt-budget controller which adjusts it */
+	int		effort;
+	float		search_limit;	// at this effort
+	float		effort_load;	// decode time / audio time (averaged)
+	unsigned int	effort_hold;	// blocks until the next adjustment
+
+	/* --low-latency: when recent input arrived, to time each frame */
+	struct {
+	    unsigned long long	end;	// stream offset after the block
+	    unsigned long long	ns;	// arrival time
+	}		arrivals[RX_ARRIVALS];
+	unsigned int	arrivals_next;
+	unsigned long long latency_total_ns;
+	unsigned long long latency_max_ns;
+	unsigned int	nlatency;
+};
+
+
+/*
+ * Search effort levels.  RX_EFFORT_DEFAULT is the fixed effort used
+ * without --rt-budget: FSK_ANALYZE_NSTEPS frame positions per search, and
+ * FSK_ANALYZE_NSTEPS_FINE when refining the frame position upon acquiring
+ * carrier (or when confidence falls), with the --limit confidence search
+ * limit.  The search limit of the other levels is scaled between the
+ * confidence threshold (0.0) and --limit (1.0), or has none (INFINITY).
+ */
+#define FSK_ANALYZE_NSTEPS		3
+#define FSK_ANALYZE_NSTEPS_FINE		8
+
+static const struct rx_effort {
+	unsigned int	nsteps;
+	unsigned int	nsteps_fine;
+	float		search_limit_scale;
+} rx_effort_levels[RX_EFFORT_NLEVELS] = {
+	{ 2,			4,			0.0f },
+	{ 2,			6,			0.5f },
+	{ FSK_ANALYZE_NSTEPS,	FSK_ANALYZE_NSTEPS_FINE,	1.0f },
+	{ 4,			12,			2.0f },
+	{ 6,			16,			INFINITY },
+};
+
+
+static int
+build_expect_bits_string( char *expect_bits_string,
+	int bfsk_nstartbits,
+	int bfsk_n_data_bits,
+	float bfsk_nstopbits,
+	int invert_start_stop,
+	int use_expect_bits,
+	unsigned long long expect_bits )
+{
+	// example expect_bits_string
+	//	  0123456789A
+	//	  isddddddddp	i == idle bit (a.k.a. prev_stop bit)
+	//			s == start bit  d == data bits  p == stop bit
+	// ebs = "10dddddddd1"  <-- expected mark/space framing pattern
+	//
+	// NOTE! expect_n_bits ends up being (frame_n_bits+1), because
+	// we expect the prev_stop bit in addition to this frame's own
+	// (start + n_data_bits + stop) bits.  But for each decoded frame,
+	// we will advance just frame_n_bits worth of samples, leaving us
+	// pointing at our stop bit -- it becomes the next frame's prev_stop.
+	//
+	//                  prev_stop--v
+	//                       start--v        v--stop
+	// char *expect_bits_string = "10dddddddd1";
+	//
+	char start_bit_value = invert_start_stop ? '1' : '0';
+	char stop_bit_value = invert_start_stop ? '0' : '1';
+	int j = 0;
+	if ( bfsk_nstopbits != 0.0f )
+	    expect_bits_string[j++] = stop_bit_value;
+	int i;
+	// Nb. only integer number of start bits works (for rx)
+	for ( i=0; i<bfsk_nstartbits; i++ )
+	    expect_bits_string[j++] = start_bit_value;
+	for ( i=0; i<bfsk_n_data_bits; i++,j++ ) {
+	    if ( use_expect_bits )
+		expect_bits_string[j] = ( (expect_bits>>i)&1 ) + '0';
+	    else
+		expect_bits_string[j] = 'd';
+	}
+	if ( bfsk_nstopbits != 0.0f )
+	    expect_bits_string[j++] = stop_bit_value;
+	expect_bits_string[j] = 0;
+
+	return j;
+}
+
+
+static void
+receiver_output( receiver *rx, int is_report, const char *buf, size_t nbytes )
+{
+    if ( rx->output_fn ) {
+	rx->output_fn(rx->output_arg, is_report, buf, nbytes);
+    } else if ( is_report ) {
+	fwrite(buf, 1, nbytes, rx->report_fp);
+    } else {
+	STATS_TIME_BEGIN(rx->statsp, t0);
+	if ( write(rx->out_fd, buf, nbytes) < 0 )
+	    perror("write");
+	STATS_TIME_END(rx->statsp, output_ns, t0);
+    }
+    if ( !is_report )
+	STATS_INC(rx->statsp, output_writes);
+}
+
+
+static void
+report_no_carrier( receiver *rx )
+{
+    char buf[256];
+    int n = 0;
+    unsigned int sample_rate = rx->sample_rate;
+    float bfsk_data_rate = rx->cfg.data_rate;
+    unsigned int nframes_decoded = rx->nframes_decoded;
+    size_t carrier_nsamples = rx->carrier_nsamples;
+
+    float nbits_decoded = nframes_decoded * rx->frame_n_bits;
+#if 0
+    fprintf(stderr, "nframes_decoded=%u\n", nframes_decoded);
+    fprintf(stderr, "nbits_decoded=%f\n", nbits_decoded);
+    fprintf(stderr, "carrier_nsamples=%lu\n", carrier_nsamples);
+#endif
+    float throughput_rate =
+		nbits_decoded * sample_rate / (float)carrier_nsamples;
+    n += snprintf(buf+n, sizeof(buf)-n, "\n### NOCARRIER ndata=%u confidence=%.3f ampl=%.3f bps=%.2f",
+	    nframes_decoded,
+	    (double)(rx->confidence_total / nframes_decoded),
+	    (double)(rx->amplitude_total / nframes_decoded),
+	    (double)(throughput_rate));
+    if ( rx->idle_nsamples_skipped )
+	n += snprintf(buf+n, sizeof(buf)-n, " skipped=%zu",
+		rx->idle_nsamples_skipped);
+    if ( rx->cfg.rt_budget > 0.0f )
+	n += snprintf(buf+n, sizeof(buf)-n, " effort=%d", rx->effort);
+    if ( rx->nlatency )
+	n += snprintf(buf+n, sizeof(buf)-n, " latency=%.1f/%.1fms",
+		rx->latency_total_ns / 1e6 / rx->nlatency,
+		rx->latency_max_ns / 1e6);
+#if 0
+    n += snprintf(buf+n, sizeof(buf)-n, " bits*sr=%llu rate*nsamp=%llu",
+	    (unsigned long long)(nbits_decoded * sample_rate + 0.5),
+	    (unsigned long long)(bfsk_data_rate * carrier_nsamples) );
+#endif
+    if ( (unsigned long long)(nbits_decoded * sample_rate + 0.5f) == (unsigned long long)(bfsk_data_rate * carrier_nsamples) ) {
+	n += snprintf(buf+n, sizeof(buf)-n, " (rate perfect) ###\n");
+    } else {
+	float throughput_skew = (throughput_rate - bfsk_data_rate)
+			    / bfsk_data_rate;
+	n += snprintf(buf+n, sizeof(buf)-n, " (%.1f%% %s) ###\n",
+		(double)(fabsf(throughput_skew) * 100.0f),
+		signbit(throughput_skew) ? "slow" : "fast"
+		);
+    }
+    receiver_output(rx, 1, buf, n);
+}
+
+
+/*
+ * --events-fd: one JSON object per line, each written with a single
+ * write() so that lines from several processes sharing the fd stay whole.
+ */
+static void
+receiver_event( receiver *rx, const char *event, const char *fmt, ... )
+{
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "{\"event\":\"%s\"", event);
+    if ( rx->stream_name ) {
+	n += snprintf(buf+n, sizeof(buf)-n, ",\"stream\":\"");
+	const unsigned char *p;
+	for ( p=(const unsigned char *)rx->stream_name; *p && n<sizeof(buf)-16; p++ ) {
+	    if ( *p == '"' || *p == '\\' )
+		n += snprintf(buf+n, sizeof(buf)-n, "\\%c", *p);
+	    else if ( *p < 0x20 )
+		n += snprintf(buf+n, sizeof(buf)-n, "\\u%04x", *p);
+	    else
+		buf[n++] = *p;
+	}
+	buf[n++] = '"';
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    n += vsnprintf(buf+n, sizeof(buf)-n, fmt, ap);
+    va_end(ap);
+    if ( n > sizeof(buf)-3 )
+	n = sizeof(buf)-3;
+    n += snprintf(buf+n, sizeof(buf)-n, "}\n");
+    if ( write(rx->cfg.events_fd, buf, n) < 0 )
+	perror("write");
+}
+
+/*
+ * A number for an event field, formatted into buf: JSON has no inf or nan
+ * (e.g. the confidence of a noise-free signal), so those are "null".
+ */
+static const char *
+json_num( char *buf, const char *fmt, double v )
+{
+    if ( !isfinite(v) )
+	return "null";
+    snprintf(buf, 64, fmt, v);
+    return buf;
+}
+#define JSON_NUM(fmt, v)	json_num((char[64]){0}, fmt, (v))
+
+static void
+receiver_event_carrier( receiver *rx )
+{
+    if ( rx->cfg.events_fd < 0 )
+	return;
+    receiver_event(rx, "carrier",
+	    ",\"sample\":%llu,\"time\":%s,\"rate\":%s"
+	    ",\"mark_f\":%s,\"space_f\":%s",
+	    rx->carrier_start,
+	    JSON_NUM("%.6f", (double)rx->carrier_start / rx->sample_rate),
+	    JSON_NUM("%.2f", rx->cfg.data_rate),
+	    JSON_NUM("%.1f", rx->fskp->b_mark * rx->fskp->band_width),
+	    JSON_NUM("%.1f", rx->fskp->b_space * rx->fskp->band_width));
+}
+
+static void
+receiver_event_nocarrier( receiver *rx )
+{
+    if ( rx->cfg.events_fd < 0 )
+	return;
+    unsigned int nframes = rx->nframes_decoded;
+    float bps = nframes * rx->frame_n_bits * rx->sample_rate
+		    / (float)rx->carrier_nsamples;
+    unsigned long long end = rx->carrier_start + rx->carrier_nsamples;
+    receiver_event(rx, "nocarrier",
+	    ",\"sample\":%llu,\"time\":%s,\"start_sample\":%llu"
+	    ",\"ndata\":%u,\"confidence\":%s,\"ampl\":%s"
+	    ",\"bps\":%s,\"skew\":%s,\"idle_skipped\":%zu,\"effort\":%d"
+	    ",\"latency_ms\":%s,\"latency_max_ms\":%s",
+	    end, JSON_NUM("%.6f", (double)end / rx->sample_rate),
+	    rx->carrier_start,
+	    nframes,
+	    JSON_NUM("%.3f", rx->confidence_total / nframes),
+	    JSON_NUM("%.3f", rx->amplitude_total / nframes),
+	    JSON_NUM("%.2f", bps),
+	    JSON_NUM("%.5f", (bps - rx->cfg.data_rate) / rx->cfg.data_rate),
+	    rx->idle_nsamples_skipped, rx->effort,
+	    JSON_NUM("%.3f", rx->nlatency
+			? rx->latency_total_ns / 1e6 / rx->nlatency : 0.0),
+	    JSON_NUM("%.3f", rx->latency_max_ns / 1e6));
+}
+
+static void
+receiver_event_session( receiver *rx )
+{
+    if ( rx->cfg.events_fd < 0 )
+	return;
+    double audio_sec = (double)rx->input_nsamples / rx->sample_rate;
+    double cpu_sec = rx->cpu_ns / 1e9;
+    receiver_event(rx, "session",
+	    ",\"samples\":%llu,\"audio_time\":%s,\"cpu_time\":%s"
+	    ",\"realtime_factor\":%s,\"carriers\":%u",
+	    rx->input_nsamples,
+	    JSON_NUM("%.6f", audio_sec), JSON_NUM("%.6f", cpu_sec),
+	    JSON_NUM("%.1f", cpu_sec > 0 ? audio_sec / cpu_sec : 0.0),
+	    rx->ncarriers);
+}
+
+/* carrier lost (or end of input): report it, and start over */
+static void
+receiver_lose_carrier( receiver *rx )
+{
+    receiver_event_nocarrier(rx);
+    if ( !rx->cfg.quiet_mode )
+	report_no_carrier(rx);
+    rx->idle_nsamples_skipped = 0;
+    rx->latency_total_ns = 0;
+    rx->latency_max_ns = 0;
+    rx->nlatency = 0;
+    rx->carrier = 0;
+    rx->carrier_nsamples = 0;
+    rx->confidence_total = 0;
+    rx->amplitude_total = 0;
+    rx->nframes_decoded = 0;
+    rx->track_amplitude = 0.0;
+}
+
+
+static void
+receiver_set_effort( receiver *rx, int effort )
+{
+    const receiver_config *cfg = &rx->cfg;
+    float scale = rx_effort_levels[effort].search_limit_scale;
+    rx->effort = effort;
+    if ( scale == 1.0f )
+	rx->search_limit = cfg->confidence_search_limit;
+    else if ( isinf(scale) )
+	rx->search_limit = INFINITY;
+    else
+	rx->search_limit = cfg->confidence_threshold
+	    + (cfg->confidence_search_limit - cfg->confidence_threshold) * scale;
+}
+
+
+receiver *
+receiver_new( const receiver_config *cfg, fsk_plan *fskp,
+	unsigned int sample_rate, int out_fd, FILE *report_fp )
+{
+    receiver *rx = calloc(1, sizeof(receiver));
+    if ( !rx ) {
+	perror("malloc");
+	return NULL;
+    }
+
+    rx->cfg = *cfg;
+    rx->fskp = fskp;
+    rx->sample_rate = sample_rate;
+    rx->out_fd = out_fd;
+    rx->report_fp = report_fp;
+
+    /*
+     * Prepare the input sample chunk rate
+     */
+    float nsamples_per_bit = sample_rate / cfg->data_rate;
+    rx->nsamples_per_bit = nsamples_per_bit;
+
+    /*
+     * Prepare the input sample buffer.  For 8-bit frames with prev/start/stop
+     * we need 11 data-bits worth of samples, and we will scan through one bits
+     * worth at a time, hence we need a minimum total input buffer size of 12
+     * data-bits.  */
+    unsigned int nbits = 0;
+    nbits += 1;			// prev stop bit (last whole stop bit)
+    nbits += cfg->nstartbits;	// start bits
+    nbits += cfg->n_data_bits;
+    nbits += 1;			// stop bit (first whole stop bit)
+
+    // FIXME EXPLAIN +1 goes with extra bit when scanning
+    size_t	samplebuf_size = ceilf(nsamples_per_bit) * (nbits+1);
+    samplebuf_size *= 2; // account for the half-buf filling method
+#define SAMPLE_BUF_DIVISOR 12
+#ifdef SAMPLE_BUF_DIVISOR
+    // For performance, use a larger samplebuf_size than necessary
+    // (unless --low-latency: then reads are about a frame's worth)
+    if ( samplebuf_size < sample_rate / SAMPLE_BUF_DIVISOR && !cfg->low_latency )
+	samplebuf_size = sample_rate / SAMPLE_BUF_DIVISOR;
+#endif
+    rx->samplebuf_size = samplebuf_size;
+    rx->samplebuf = malloc(samplebuf_size * sizeof(float));
+    if ( !rx->samplebuf ) {
+	perror("malloc");
+	free(rx);
+	return NULL;
+    }
+    rx->window = rx->samplebuf;
+    debug_log("samplebuf_size=%zu\n", samplebuf_size);
+
+    // Fraction of nsamples_per_bit that we will "overscan"; range (0.0 .. 1.0)
+    float fsk_frame_overscan = 0.5;
+    //   should be != 0.0 (only the nyquist edge cases actually require this?)
+    // for handling of slightly faster-than-us rates:
+    //   should be >> 0.0 to allow us to lag back for faster-than-us rates
+    //   should be << 1.0 or we may lag backwards over whole bits
+    // for optimal analysis:
+    //   should be >= 0.5 (half a bit width) or we may not find the optimal bit
+    //   should be <  1.0 (a full bit width) or we may skip over whole bits
+    // for encodings without start/stop bits:
+    //     MUST be <= 0.5 or we may accidentally skip a bit
+    //
+    assert( fsk_frame_overscan >= 0.0f && fsk_frame_overscan < 1.0f );
+
+    // ensure that we overscan at least a single sample
+    unsigned int nsamples_overscan
+			= nsamples_per_bit * fsk_frame_overscan + 0.5f;
+    if ( fsk_frame_overscan > 0.0f && nsamples_overscan == 0 )
+	nsamples_overscan = 1;
+    debug_log("fsk_frame_overscan=%f nsamples_overscan=%u\n",
+	    fsk_frame_overscan, nsamples_overscan);
+    rx->nsamples_overscan = nsamples_overscan;
+
+    // n databits plus bfsk_startbit start bits plus bfsk_nstopbit stop bits:
+    unsigned int bfsk_frame_n_bits = cfg->n_data_bits + cfg->nstartbits
+					+ cfg->nstopbits;
+    rx->frame_n_bits = bfsk_frame_n_bits;
+    rx->frame_nsamples = nsamples_per_bit * rx->frame_n_bits + 0.5f;
+
+    unsigned int expect_n_bits;
+    if ( cfg->expect_data_string ) {
+	assert( strlen(cfg->expect_data_string) < sizeof(rx->expect_data_string) );
+	strcpy(rx->expect_data_string, cfg->expect_data_string);
+	expect_n_bits = cfg->expect_n_bits;
+    } else {
+	expect_n_bits = build_expect_bits_string(rx->expect_data_string,
+		cfg->nstartbits, cfg->n_data_bits, cfg->nstopbits,
+		cfg->invert_start_stop, 0, 0);
+    }
+    debug_log("eds = '%s' (%lu)\n", rx->expect_data_string,
+	    strlen(rx->expect_data_string));
+
+    if ( !cfg->expect_data_string && cfg->do_rx_sync
+	    && (long long) cfg->sync_byte >= 0 ) {
+	build_expect_bits_string(rx->expect_sync_string,
+		cfg->nstartbits, cfg->n_data_bits, cfg->nstopbits,
+		cfg->invert_start_stop, 1, cfg->sync_byte);
+    } else {
+	strcpy(rx->expect_sync_string, rx->expect_data_string);
+    }
+    debug_log("ess = '%s' (%lu)\n", rx->expect_sync_string,
+	    strlen(rx->expect_sync_string));
+
+    rx->expect_nsamples = nsamples_per_bit * expect_n_bits;
+
+    /*
+     * The idle gate measures the input in chunks of one no-carrier search
+     * step (try_max_nsamples, below).  It is not used with carrier
+     * autodetection, which searches for its tones in its own way.
+     */
+    if ( cfg->carrier_autodetect_threshold <= 0.0f ) {
+	unsigned int chunk_nsamples = (unsigned int)nsamples_per_bit
+					+ nsamples_overscan;
+	unsigned int nchunks_max = samplebuf_size / chunk_nsamples + 1;
+	rx->gate_tone = malloc(nchunks_max * sizeof(float));
+	rx->gate_energy = malloc(nchunks_max * sizeof(float));
+	if ( !rx->gate_tone || !rx->gate_energy ) {
+	    perror("malloc");
+	    receiver_destroy(rx);
+	    return NULL;
+	}
+	rx->gate_chunk_nsamples = chunk_nsamples;
+    }
+
+    int effort = RX_EFFORT_DEFAULT;
+    if ( cfg->rt_budget > 0.0f ) {
+	assert( cfg->effort_min <= cfg->effort_max
+		&& cfg->effort_max < RX_EFFORT_NLEVELS );
+	if ( effort < cfg->effort_min )
+	    effort = cfg->effort_min;
+	if ( effort > cfg->effort_max )
+	    effort = cfg->effort_max;
+    }
+    receiver_set_effort(rx, effort);
+
+    rx->carrier_band = -1;
+    rx->reading = 1;
+
+#if USE_STATS
+    if ( cfg->stats ) {
+	rx->statsp = &rx->stats;
+	rx->stats.start_ns = stats_now_ns();
+    }
+#endif
+
+    return rx;
+}
+
+void
+receiver_set_output( receiver *rx, receiver_output_fn *fn, void *arg )
+{
+    rx->output_fn = fn;
+    rx->output_arg = arg;
+}
+
+void
+receiver_set_stream_name( receiver *rx, const char *stream_name )
+{
+    free(rx->stream_name);
+    rx->stream_name = stream_name ? strdup(stream_name) : NULL;
+}
+
+void
+receiver_destroy( receiver *rx )
+{
+    free(rx->stream_name);
+    free(rx->gate_tone);
+    free(rx->gate_energy);
+    free(rx->samplebuf);
+    free(rx);
+}
+
+
+/*
+ * Leave in-place mode: copy the current window into samplebuf, so that the
+ * rest of the mapped input can be fed in the ordinary way.
+ */
+static void
+receiver_unmap( receiver *rx )
+{
+    size_t n = rx->mapped_nsamples - rx->mapped_pos;
+    if ( n > rx->samplebuf_size )
+	n = rx->samplebuf_size;
+    memcpy(rx->samplebuf, rx->mapped + rx->mapped_pos, n * sizeof(float));
+    rx->window = rx->samplebuf;
+    rx->mapped_nread = rx->mapped_pos + rx->samples_nvalid;
+    rx->mapped = NULL;
+}
+
+
+/*
+ * The window is shifting by nsamples: keep what the idle gate has measured,
+ * if it still lines up with its chunks.
+ */
+static void
+receiver_gate_shift( receiver *rx, size_t nsamples )
+{
+    unsigned int chunk_nsamples = rx->gate_chunk_nsamples;
+    if ( !rx->gate_nchunks )
+	return;
+    if ( nsamples % chunk_nsamples ) {
+	rx->gate_nchunks = 0;
+	return;
+    }
+    unsigned int n = nsamples / chunk_nsamples;
+    if ( n >= rx->gate_nchunks ) {
+	rx->gate_nchunks = 0;
+	return;
+    }
+    rx->gate_nchunks -= n;
+    memmove(rx->gate_tone, rx->gate_tone+n, rx->gate_nchunks*sizeof(float));
+    memmove(rx->gate_energy, rx->gate_energy+n, rx->gate_nchunks*sizeof(float));
+}
+
+/*
+ * Idle gate: while there is no carrier, count the leading search steps
+ * (of one chunk each) which cannot possibly find a frame, because the
+ * samples they would analyze are silent, or hold less energy at the mark
+ * and space tones than even white noise would (e.g. hum).  Nb. there is
+ * no absolute level threshold: minimodem decodes signals of any amplitude.
+ */
+#define RX_IDLE_GATE_MIN_TONE_RATIO	0.5f	// relative to white noise
+
+static unsigned int
+receiver_idle_gate( receiver *rx )
+{
+    unsigned int chunk_nsamples = rx->gate_chunk_nsamples;
+    unsigned int navail = rx->samples_nvalid / chunk_nsamples;
+
+    // a step analyzes frames starting anywhere within its own chunk
+    unsigned int step_nchunks = 1
+	    + (rx->expect_nsamples + 1 + chunk_nsamples - 1) / chunk_nsamples;
+    float min_tone_ratio = RX_IDLE_GATE_MIN_TONE_RATIO * 4.0f / chunk_nsamples;
+
+    for ( ; rx->gate_nchunks < navail; rx->gate_nchunks++ ) {
+	unsigned int i = rx->gate_nchunks;
+	fsk_tone_energy(rx->fskp, rx->window + i * chunk_nsamples,
+		chunk_nsamples, &rx->gate_tone[i], &rx->gate_energy[i]);
+    }
+
+    unsigned int j, k;
+    for ( j=0; j+step_nchunks<=navail; j++ ) {
+	float tone = 0.0f, energy = 0.0f;
+	for ( k=j; k<j+step_nchunks; k++ ) {
+	    tone += rx->gate_tone[k];
+	    energy += rx->gate_energy[k];
+	}
+	if ( energy > 0.0f && tone >= min_tone_ratio * energy )
+	    break;
+    }
+    return j;
+}
+
+
+static unsigned long long
+receiver_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long
+receiver_wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * How much input the receiver waits for: a half-buffer, or with
+ * --low-latency just enough to top the window up to a half-buffer, so
+ * that each frame is analyzed as soon as its last bit is in.
+ */
+static size_t
+receiver_read_want( receiver *rx )
+{
+    size_t half = rx->samplebuf_size/2;
+    if ( rx->cfg.low_latency && rx->samples_nvalid < half )
+	return half - rx->samples_nvalid;
+    return half;
+}
+
+/* --low-latency: time from the arrival of a frame's last sample to now */
+static void
+receiver_measure_latency( receiver *rx, unsigned long long frame_end )
+{
+    unsigned int i, best = RX_ARRIVALS;
+    for ( i=0; i<RX_ARRIVALS; i++ ) {
+	if ( rx->arrivals[i].end < frame_end || rx->arrivals[i].ns == 0 )
+	    continue;
+	if ( best == RX_ARRIVALS || rx->arrivals[i].end < rx->arrivals[best].end )
+	    best = i;
+    }
+    if ( best == RX_ARRIVALS )
+	return;		// e.g. mapped input: no reads to time
+    unsigned long long latency = receiver_wall_ns() - rx->arrivals[best].ns;
+    rx->latency_total_ns += latency;
+    if ( rx->latency_max_ns < latency )
+	rx->latency_max_ns = latency;
+    rx->nlatency++;
+}
+
+
+/*
+ * Run the main loop over the samples in the window, until it needs another
+ * half-buffer of input (or, after end of input, until it is done).
+ */
+static void
+receiver_run_loop( receiver *rx )
+{
+    const receiver_config *cfg = &rx->cfg;
+    fsk_plan *fskp = rx->fskp;
+    size_t samplebuf_size = rx->samplebuf_size;
+    float nsamples_per_bit = rx->nsamples_per_bit;
+    unsigned int nsamples_overscan = rx->nsamples_overscan;
+    unsigned int expect_nsamples = rx->expect_nsamples;
+
+    while ( !rx->done ) {
+
+	if ( !rx->reading ) {
+
+	    debug_log("advance=%u\n", rx->advance);
+
+	    /* Shift the samples in the window by 'advance' samples */
+	    assert( rx->advance <= samplebuf_size );
+	    if ( rx->advance == samplebuf_size ) {
+		rx->window_pos += rx->samples_nvalid;
+		rx->mapped_pos += rx->samples_nvalid;
+		rx->samples_nvalid = 0;
+		rx->advance = 0;
+		rx->gate_nchunks = 0;
+	    }
+	    if ( rx->advance ) {
+		if ( rx->advance > rx->samples_nvalid ) {
+		    rx->done = 1;
+		    break;
+		}
+		rx->window_pos += rx->advance;
+		if ( rx->mapped )
+		    rx->mapped_pos += rx->advance;
+		else
+		    memmove(rx->samplebuf, rx->samplebuf+rx->advance,
+			    (samplebuf_size-rx->advance)*sizeof(float));
+		rx->samples_nvalid -= rx->advance;
+		receiver_gate_shift(rx, rx->advance);
+	    }
+	    if ( rx->mapped ) {
+		// the window must stay whole samplebuf_size inside the mapping
+		if ( rx->mapped_pos + samplebuf_size > rx->mapped_nsamples )
+		    receiver_unmap(rx);
+		else
+		    rx->window = rx->mapped + rx->mapped_pos;
+	    }
+
+	    if ( rx->samples_nvalid < samplebuf_size/2 )
+		rx->reading = 1;
+	}
+
+	if ( rx->reading ) {
+	    /* Wait for more samples to fill samplebuf (by half) */
+	    if ( !rx->eof && rx->read_nsamples < receiver_read_want(rx) )
+		return;
+	    rx->samples_nvalid += rx->read_nsamples;
+	    rx->read_nsamples = 0;
+	    rx->reading = 0;
+	}
+
+	if ( rx->samples_nvalid == 0 ) {
+	    rx->done = 1;
+	    break;
+	}
+
+	/* Auto-detect carrier frequency */
+	if ( cfg->carrier_autodetect_threshold > 0.0f && rx->carrier_band < 0 ) {
+	    unsigned int i;
+	    float nsamples_per_scan = nsamples_per_bit;
+	    if ( nsamples_per_scan > fskp->fftsize )
+		nsamples_per_scan = fskp->fftsize;
+	    for ( i=0; i+nsamples_per_scan<=rx->samples_nvalid;
+						 i+=nsamples_per_scan ) {
+		STATS_SET(fskp->stats, rx->statsp ? &rx->statsp->detect : NULL);
+		rx->carrier_band = fsk_detect_carrier(fskp,
+				    rx->window+i, nsamples_per_scan,
+				    cfg->carrier_autodetect_threshold);
+		if ( rx->carrier_band >= 0 )
+		    break;
+	    }
+	    rx->advance = i + nsamples_per_scan;
+	    if ( rx->advance > rx->samples_nvalid )
+		rx->advance = rx->samples_nvalid;
+	    if ( rx->carrier_band < 0 ) {
+		debug_log("autodetected carrier band not found\n");
+		continue;
+	    }
+
+	    // default negative shift -- reasonable?
+	    int b_shift = - (float)(cfg->autodetect_shift + fskp->band_width/2.0f)
+						/ fskp->band_width;
+	    if ( cfg->inverted_freqs )
+		b_shift *= -1;
+	    /* only accept a carrier as b_mark if it will not result
+	     * in a b_space band which is "too low". */
+	    int b_space = rx->carrier_band + b_shift;
+	    if ( b_space < 1 || b_space >= fskp->nbands ) {
+		debug_log("autodetected space band out of range\n" );
+		rx->carrier_band = -1;
+		continue;
+	    }
+
+	    debug_log("### TONE freq=%.1f ###\n",
+		    rx->carrier_band * fskp->band_width);
+
+	    fsk_set_tones_by_bandshift(fskp, /*b_mark*/rx->carrier_band, b_shift);
+	}
+
+	/*
+	 * The main processing algorithm: scan samplesbuf for FSK frames,
+	 * looking at an entire frame at once.
+	 */
+
+	debug_log( "--------------------------\n");
+
+	if ( rx->samples_nvalid < expect_nsamples ) {
+	    rx->done = 1;
+	    break;
+	}
+
+	// try_max_nsamples
+	// serves two purposes
+	// 1. avoids finding a non-optimal first frame
+	// 2. allows us to track slightly slow signals
+	unsigned int try_max_nsamples;
+	if ( rx->carrier )
+	    try_max_nsamples = nsamples_per_bit * 0.75f + 0.5f;
+	else
+	    try_max_nsamples = nsamples_per_bit;
+	try_max_nsamples += nsamples_overscan;
+
+	if ( !rx->carrier && rx->gate_chunk_nsamples ) {
+	    assert( try_max_nsamples == rx->gate_chunk_nsamples );
+	    unsigned int nidle = receiver_idle_gate(rx);
+	    if ( nidle ) {
+		rx->advance = nidle * try_max_nsamples;
+		rx->idle_nsamples_skipped += rx->advance;
+		STATS_ADD(rx->statsp, idle_nsamples_skipped, rx->advance);
+		rx->noconfidence += nidle;
+		debug_log("@ IDLE skip=%u\n", rx->advance);
+		continue;
+	    }
+	}
+
+	// FSK_ANALYZE_NSTEPS Try 3 frame positions across the try_max_nsamples
+	// range.  Using a larger nsteps allows for more accurate tracking of
+	// fast/slow signals (at decreased performance).  Note also
+	// FSK_ANALYZE_NSTEPS_FINE below, which refines the frame
+	// position upon first acquiring carrier, or if confidence falls.
+	// (Both are set by the search effort level.)
+	const struct rx_effort *effort = &rx_effort_levels[rx->effort];
+	unsigned int try_step_nsamples = try_max_nsamples / effort->nsteps;
+	if ( try_step_nsamples == 0 )
+	    try_step_nsamples = 1;
+
+	float confidence, amplitude;
+	unsigned long long bits = 0;
+	/* Note: frame_start_sample is actually the sample where the
+	 * prev_stop bit begins (since the "frame" includes the prev_stop). */
+	unsigned int frame_start_sample = 0;
+
+	unsigned int try_first_sample;
+	float try_confidence_search_limit;
+
+	try_confidence_search_limit = rx->search_limit;
+	try_first_sample = rx->carrier ? nsamples_overscan : 0;
+
+	STATS_SET(fskp->stats, rx->statsp ? &rx->statsp->search : NULL);
+	confidence = fsk_find_frame(fskp, rx->window, expect_nsamples,
+			try_first_sample,
+			try_max_nsamples,
+			try_step_nsamples,
+			try_confidence_search_limit,
+			rx->carrier ? rx->expect_data_string : rx->expect_sync_string,
+			&bits,
+			&amplitude,
+			&frame_start_sample
+			);
+
+	int do_refine_frame = 0;
+
+	if ( confidence < rx->peak_confidence * 0.75f ) {
+	    do_refine_frame = 1;
+	    debug_log(" ... do_refine_frame rescan (confidence %.3f << %.3f peak)\n", confidence, rx->peak_confidence);
+	    rx->peak_confidence = 0;
+	}
+
+	// no-confidence if amplitude drops abruptly to < 25% of the
+	// track_amplitude, which follows amplitude with hysteresis
+	if ( amplitude < rx->track_amplitude * 0.25f ) {
+	    confidence = 0;
+	}
+
+#define FSK_MAX_NOCONFIDENCE_BITS	20
+
+	if ( confidence <= cfg->confidence_threshold ) {
+
+	    // FIXME: explain
+	    if ( ++rx->noconfidence > FSK_MAX_NOCONFIDENCE_BITS )
+	    {
+		rx->carrier_band = -1;
+		if ( rx->carrier ) {
+		    receiver_lose_carrier(rx);
+
+		    if ( cfg->rx_one ) {
+			rx->done = 1;
+			break;
+		    }
+		}
+	    }
+
+	    /* Advance the sample stream forward by try_max_nsamples so the
+	     * next time around the loop we continue searching from where
+	     * we left off this time.		*/
+	    rx->advance = try_max_nsamples;
+	    debug_log("@ NOCONFIDENCE=%u advance=%u\n", rx->noconfidence, rx->advance);
+	    continue;
+	}
+
+	// Add a frame's worth of samples to the sample count
+	rx->carrier_nsamples += rx->frame_nsamples;
+
+	if ( rx->carrier ) {
+
+	    // If we already had carrier, adjust sample count +start -overscan
+	    rx->carrier_nsamples += frame_start_sample;
+	    rx->carrier_nsamples -= nsamples_overscan;
+
+	} else {
+
+	    // We just acquired carrier.
+
+	    if ( !cfg->quiet_mode ) {
+		char buf[64];
+		int n;
+		if ( cfg->data_rate >= 100 )
+		    n = snprintf(buf, sizeof(buf), "### CARRIER %u @ %.1f Hz ",
+			    (unsigned int)(cfg->data_rate + 0.5f),
+			    (double)(fskp->b_mark * fskp->band_width));
+		else
+		    n = snprintf(buf, sizeof(buf), "### CARRIER %.2f @ %.1f Hz ",
+			    (double)(cfg->data_rate),
+			    (double)(fskp->b_mark * fskp->band_width));
+		n += snprintf(buf+n, sizeof(buf)-n, "###\n");
+		receiver_output(rx, 1, buf, n);
+	    }
+
+	    rx->carrier = 1;
+	    rx->ncarriers++;
+	    // reset the frame processor
+	    cfg->databits_decode(&rx->databits_state, 0, 0, 0, 0);
+
+	    do_refine_frame = 1;
+	    debug_log(" ... do_refine_frame rescan (acquired carrier)\n");
+	}
+
+	if ( do_refine_frame )
+	{
+	    if ( confidence < INFINITY && try_step_nsamples > 1 ) {
+		// FSK_ANALYZE_NSTEPS_FINE:
+		// Scan again, but try harder to find the best frame.
+		// Since we found a valid confidence frame in the "sloppy"
+		// fsk_find_frame() call already, we're sure to find one at
+		// least as good this time.
+		try_step_nsamples = try_max_nsamples / effort->nsteps_fine;
+		if ( try_step_nsamples == 0 )
+		    try_step_nsamples = 1;
+		try_confidence_search_limit = INFINITY;
+		float confidence2, amplitude2;
+		unsigned long long bits2;
+		unsigned int frame_start_sample2;
+		STATS_SET(fskp->stats, rx->statsp ? &rx->statsp->refine : NULL);
+		confidence2 = fsk_find_frame(fskp, rx->window, expect_nsamples,
+			    try_first_sample,
+			    try_max_nsamples,
+			    try_step_nsamples,
+			    try_confidence_search_limit,
+			    rx->carrier ? rx->expect_data_string : rx->expect_sync_string,
+			    &bits2,
+			    &amplitude2,
+			    &frame_start_sample2
+			    );
+		if ( confidence2 > confidence ) {
+		    bits = bits2;
+		    amplitude = amplitude2;
+		    frame_start_sample = frame_start_sample2;
+		}
+	    }
+	}
+
+	if ( rx->nframes_decoded == 0 ) {
+	    rx->carrier_start = rx->window_pos + frame_start_sample;
+	    receiver_event_carrier(rx);
+	}
+
+	rx->track_amplitude = ( rx->track_amplitude + amplitude ) / 2;
+	if ( rx->peak_confidence < confidence )
+	    rx->peak_confidence = confidence;
+	debug_log("@ confidence=%.3f peak_conf=%.3f amplitude=%.3f track_amplitude=%.3f\n",
+		confidence, rx->peak_confidence, amplitude, rx->track_amplitude );
+
+	rx->confidence_total += confidence;
+	rx->amplitude_total += amplitude;
+	rx->nframes_decoded++;
+	STATS_INC(rx->statsp, frames_decoded);
+	rx->noconfidence = 0;
+
+	// Advance the sample stream forward past the junk before the
+	// frame starts (frame_start_sample), and then past decoded frame
+	// (see also NOTE about frame_n_bits and expect_n_bits)...
+	// But actually advance just a bit less than that to allow
+	// for tracking slightly fast signals, hence - nsamples_overscan.
+	rx->advance = frame_start_sample + rx->frame_nsamples - nsamples_overscan;
+
+	debug_log("@ nsamples_per_bit=%.3f n_data_bits=%u "
+			" frame_start=%u advance=%u\n",
+		    nsamples_per_bit, cfg->n_data_bits,
+		    frame_start_sample, rx->advance);
+
+	// chop off the prev_stop bit
+	if ( cfg->nstopbits != 0.0f )
+	    bits = bits >> 1;
+
+
+	/*
+	 * Send the raw data frame bits to the backend frame processor
+	 * for final conversion to output data bytes.
+	 */
+
+	// chop off framing bits
+	bits = bit_window(bits, cfg->nstartbits, cfg->n_data_bits);
+	if (cfg->msb_first) {
+		bits = bit_reverse(bits, cfg->n_data_bits);
+	}
+	debug_log("Input: %08x%08x - Databits: %u - Shift: %i\n", (unsigned int)(bits >> 32), (unsigned int)bits, cfg->n_data_bits, cfg->nstartbits);
+
+	unsigned int dataout_size = 4096;
+	char dataoutbuf[4096];
+	unsigned int dataout_nbytes = 0;
+
+	// suppress printing of bfsk_sync_byte bytes
+	if ( cfg->do_rx_sync ) {
+	    if ( dataout_nbytes == 0 && bits == cfg->sync_byte )
+		continue;
+	}
+
+	dataout_nbytes += cfg->databits_decode(&rx->databits_state,
+						dataoutbuf + dataout_nbytes,
+						dataout_size - dataout_nbytes,
+						bits, (int)cfg->n_data_bits);
+
+	if ( dataout_nbytes == 0 )
+	    continue;
+
+	/*
+	 * Print the output buffer to out_fd
+	 */
+	if ( cfg->output_print_filter == 0 ) {
+	    receiver_output(rx, 0, dataoutbuf, dataout_nbytes);
+	} else {
+	    char *p = dataoutbuf;
+	    for ( ; dataout_nbytes; p++,dataout_nbytes-- ) {
+		char printable_char = isprint(*p)||isspace(*p) ? *p : '.';
+		receiver_output(rx, 0, &printable_char, 1);
+	    }
+	}
+	if ( cfg->low_latency )
+	    receiver_measure_latency(rx,
+		    rx->window_pos + frame_start_sample + expect_nsamples);
+
+    } /* end of the main loop */
+}
+
+/*
+ * --rt-budget: after each block of input, compare the time it took to
+ * decode with the block's audio duration.  When the (averaged) load is
+ * over budget, step the search effort down; when there is plenty of
+ * headroom, step it back up.  Wall clock time is what matters here, as a
+ * busy host delays us whether or not we are the ones using its CPU.
+ */
+#define RX_EFFORT_LOAD_WEIGHT	0.25f	// of each new block in the average
+#define RX_EFFORT_HEADROOM	0.5f	// raise effort below this * budget
+#define RX_EFFORT_HOLD_BLOCKS	8	// let a change settle before the next
+
+static void
+receiver_adjust_effort( receiver *rx, unsigned long long elapsed_ns,
+	unsigned long long nsamples )
+{
+    const receiver_config *cfg = &rx->cfg;
+    float load = elapsed_ns * 1e-9f * rx->sample_rate / nsamples;
+    rx->effort_load += (load - rx->effort_load) * RX_EFFORT_LOAD_WEIGHT;
+
+    if ( rx->effort_hold ) {
+	rx->effort_hold--;
+	return;
+    }
+    int effort = rx->effort;
+    if ( rx->effort_load > cfg->rt_budget && effort > cfg->effort_min )
+	effort--;
+    else if ( rx->effort_load < cfg->rt_budget * RX_EFFORT_HEADROOM
+	    && effort < cfg->effort_max )
+	effort++;
+    if ( effort != rx->effort ) {
+	debug_log("@ EFFORT %d -> %d (load=%.3f)\n", rx->effort, effort,
+		rx->effort_load);
+	receiver_set_effort(rx, effort);
+	rx->effort_hold = RX_EFFORT_HOLD_BLOCKS;
+    }
+}
+
+static void
+receiver_run( receiver *rx )
+{
+    const receiver_config *cfg = &rx->cfg;
+    if ( cfg->events_fd < 0 && !(cfg->rt_budget > 0.0f) ) {
+	receiver_run_loop(rx);
+	return;
+    }
+    unsigned long long pos0 = rx->window_pos;
+    unsigned long long t0 = cfg->events_fd >= 0 ? receiver_cpu_ns() : 0;
+    unsigned long long w0 = receiver_wall_ns();
+    receiver_run_loop(rx);
+    if ( cfg->events_fd >= 0 )
+	rx->cpu_ns += receiver_cpu_ns() - t0;
+    if ( cfg->rt_budget > 0.0f && rx->window_pos > pos0 )
+	receiver_adjust_effort(rx, receiver_wall_ns() - w0,
+		rx->window_pos - pos0);
+}
+
+
+float *
+receiver_get_read_buffer( receiver *rx, size_t *nsamples_outp )
+{
+    if ( rx->done || !rx->reading ) {
+	*nsamples_outp = 0;
+	return NULL;
+    }
+    assert( rx->samples_nvalid + rx->samplebuf_size/2 <= rx->samplebuf_size );
+    *nsamples_outp = receiver_read_want(rx) - rx->read_nsamples;
+    return rx->samplebuf + rx->samples_nvalid + rx->read_nsamples;
+}
+
+int
+receiver_commit_read( receiver *rx, size_t nsamples )
+{
+    rx->read_nsamples += nsamples;
+    rx->input_nsamples += nsamples;
+    if ( rx->cfg.low_latency && nsamples ) {
+	unsigned int i = rx->arrivals_next++ % RX_ARRIVALS;
+	rx->arrivals[i].end = rx->input_nsamples;
+	rx->arrivals[i].ns = receiver_wall_ns();
+    }
+    assert( rx->read_nsamples <= rx->samplebuf_size/2 );
+    receiver_run(rx);
+    return rx->done;
+}
+
+int
+receiver_process( receiver *rx, const float *samples, size_t nsamples )
+{
+    while ( nsamples && !rx->done ) {
+	size_t n;
+	float *buf = receiver_get_read_buffer(rx, &n);
+	if ( n > nsamples )
+	    n = nsamples;
+	memcpy(buf, samples, n * sizeof(float));
+	samples += n;
+	nsamples -= n;
+	receiver_commit_read(rx, n);
+    }
+    return rx->done;
+}
+
+void
+receiver_report_stats( receiver *rx )
+{
+#if USE_STATS
+    struct receiver_stats *st = rx->statsp;
+    if ( !st )
+	return;
+
+    char buf[512];
+    int n = 0;
+    n += snprintf(buf+n, sizeof(buf)-n,
+	    "### STATS elapsed=%.3fs read_calls=%llu read_wait=%.3fs ###\n",
+	    (stats_now_ns() - st->start_ns) / 1e9,
+	    st->read_calls, st->read_wait_ns / 1e9);
+    const char *stage_names[] = { "search", "refine", "detect" };
+    const fsk_stats *stages[] = { &st->search, &st->refine, &st->detect };
+    unsigned int i;
+    for ( i=0; i<3; i++ )
+	n += snprintf(buf+n, sizeof(buf)-n,
+		"### STATS %s: frame_analyze=%llu early_reject=%llu fft=%llu ###\n",
+		stage_names[i], stages[i]->frame_analyses,
+		stages[i]->early_rejects, stages[i]->fft_execs);
+    n += snprintf(buf+n, sizeof(buf)-n,
+	    "### STATS frames=%llu idle_skipped=%llu output_writes=%llu output_time=%.3fs ###\n",
+	    st->frames_decoded, st->idle_nsamples_skipped,
+	    st->output_writes, st->output_ns / 1e9);
+    receiver_output(rx, 1, buf, n);
+#endif
+}
+
+const struct receiver_stats *
+receiver_get_stats( receiver *rx )
+{
+    return rx->statsp;
+}
+
+/* report the stats if SIGUSR1 asked for them */
+static void
+receiver_check_stats_request( receiver *rx )
+{
+#if USE_STATS
+    if ( receiver_stats_requested ) {
+	receiver_stats_requested = 0;
+	receiver_report_stats(rx);
+    }
+#endif
+}
+
+void
+receiver_finish( receiver *rx )
+{
+    rx->eof = 1;
+    receiver_run(rx);
+
+    if ( rx->carrier )
+	receiver_lose_carrier(rx);
+
+    receiver_event_session(rx);
+    receiver_report_stats(rx);
+}
+
+
+/*
+ * Run the receiver over a whole input stream which is already in memory
+ * (e.g. a mapped file).  The window points directly into the input for as
+ * long as a whole samplebuf_size of it remains ahead; only the tail end is
+ * copied through samplebuf.
+ */
+static void
+receiver_read_mapped( receiver *rx, const float *samples, size_t nsamples,
+	volatile sig_atomic_t *stopp )
+{
+    size_t half = rx->samplebuf_size/2;
+
+    assert( rx->reading && rx->samples_nvalid == 0 && rx->read_nsamples == 0 );
+
+    rx->mapped_nread = 0;
+    if ( nsamples >= rx->samplebuf_size ) {
+	rx->mapped = samples;
+	rx->mapped_nsamples = nsamples;
+	rx->mapped_pos = 0;
+	rx->window = samples;
+    }
+    while ( rx->mapped && !rx->done && !( stopp && *stopp ) ) {
+	rx->read_nsamples = half;
+	receiver_run(rx);
+	receiver_check_stats_request(rx);
+    }
+    if ( rx->mapped )
+	receiver_unmap(rx);
+    rx->input_nsamples += rx->mapped_nread;
+
+    size_t pos = rx->mapped_nread;
+    while ( pos < nsamples && !rx->done && !( stopp && *stopp ) ) {
+	size_t n = nsamples - pos;
+	if ( n > half )
+	    n = half;
+	receiver_process(rx, samples + pos, n);
+	pos += n;
+	receiver_check_stats_request(rx);
+    }
+}
+
+
+/*
+ * Feed an input audio stream through the receiver until end of input
+ * (or until *stopp is set).  Samples are read directly into the
+ * receiver's buffer, or demodulated in place if sa can map its input.
+ */
+int
+receiver_read_audio( receiver *rx, simpleaudio *sa, volatile sig_atomic_t *stopp )
+{
+    int ret = 0;
+
+    size_t nmapped;
+    const float *mapped = simpleaudio_map(sa, &nmapped);
+    if ( mapped ) {
+	receiver_read_mapped(rx, mapped, nmapped, stopp);
+	receiver_finish(rx);
+	return 0;
+    }
+
+    while ( !( stopp && *stopp ) ) {
+	size_t read_nsamples;
+	float *samples_readptr = receiver_get_read_buffer(rx, &read_nsamples);
+	/* Read more samples into samplebuf (fill it) */
+	assert ( read_nsamples > 0 );
+	ssize_t r;
+	STATS_TIME_BEGIN(rx->statsp, t0);
+	r = simpleaudio_read(sa, samples_readptr, read_nsamples);
+	STATS_TIME_END(rx->statsp, read_wait_ns, t0);
+	STATS_INC(rx->statsp, read_calls);
+	debug_log("simpleaudio_read(n=%zu) returns %zd\n", read_nsamples, r);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = -1;
+	    break;
+	}
+	if ( r == 0 )
+	    break;
+	if ( receiver_commit_read(rx, r) )
+	    break;
+	receiver_check_stats_request(rx);
+    }
+
+    receiver_finish(rx);
+
+    return ret;
+}
@@ -0,0 +1,169 @@
+/*
+ * receiver.h
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <stdio.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "simpleaudio.h"
+#include "fsk.h"
+#include "databits.h"
+
+/*
+ * The FSK receiver: the minimodem --rx main loop, packaged as an object
+ * so that one process can run it over any number of input streams.
+ *
+ * Samples are pushed in; decoded data is written to out_fd and the
+ * CARRIER/NOCARRIER reports to report_fp.
+ */
+
+typedef struct receiver_config receiver_config;
+
+struct receiver_config {
+	float		data_rate;
+	float		mark_f;
+	float		space_f;
+	float		band_width;
+	unsigned int	n_data_bits;
+	int		nstartbits;
+	float		nstopbits;
+	int		invert_start_stop;
+	int		msb_first;
+	unsigned int	do_rx_sync;
+	unsigned long long sync_byte;
+	const char	*expect_data_string;	// NULL: derive from the framing
+	unsigned int	expect_n_bits;
+	int		inverted_freqs;
+	int		autodetect_shift;
+	float		carrier_autodetect_threshold;
+	float		confidence_threshold;
+	float		confidence_search_limit;
+	databits_decoder *databits_decode;
+	int		output_print_filter;
+	int		rx_one;
+	int		quiet_mode;
+	int		stats;		// --stats
+	int		events_fd;	// --events-fd, or -1
+	float		rt_budget;	// --rt-budget, or 0 for fixed effort
+	int		effort_min;	// --rt-effort {min}:{max}
+	int		effort_max;
+	int		low_latency;	// --low-latency
+};
+
+/*
+ * Search effort levels 0 (least) to RX_EFFORT_NLEVELS-1; the default is
+ * the effort used without --rt-budget.
+ */
+#define RX_EFFORT_NLEVELS	5
+#define RX_EFFORT_DEFAULT	2
+
+/*
+ * --low-latency: read input in blocks of about a frame (rather than at
+ * least 1/12 second), analyze each frame as soon as its last bit is in,
+ * and time each frame from the arrival of that bit to its output write
+ * ("latency={avg}/{max}ms" in the NOCARRIER report).  RX_LOW_LATENCY_US
+ * is the audio system buffering to ask for.
+ */
+#define RX_LOW_LATENCY_US	10000
+
+typedef struct receiver receiver;
+
+receiver *
+receiver_new( const receiver_config *cfg, fsk_plan *fskp,
+	unsigned int sample_rate, int out_fd, FILE *report_fp );
+
+/*
+ * Divert the receiver's output to fn() instead of out_fd and report_fp.
+ * is_report is 1 for CARRIER/NOCARRIER reports, 0 for decoded data.
+ */
+typedef void (receiver_output_fn)( void *arg, int is_report,
+	const char *buf, size_t nbytes );
+
+void
+receiver_set_output( receiver *rx, receiver_output_fn *fn, void *arg );
+
+/*
+ * Name the stream in the events written to cfg->events_fd, one JSON
+ * object per line:
+ *   {"event":"carrier", ...}	carrier acquired: sample offset, tones
+ *   {"event":"nocarrier", ...}	carrier lost: sample offsets, ndata,
+ *				average confidence and amplitude, bps, skew
+ *   {"event":"session", ...}	end of input: samples, decode cpu time
+ */
+void
+receiver_set_stream_name( receiver *rx, const char *stream_name );
+
+void
+receiver_destroy( receiver *rx );
+
+/*
+ * Zero-copy input: read up to *nsamples_outp samples directly into the
+ * returned buffer, then hand them over with receiver_commit_read().
+ */
+float *
+receiver_get_read_buffer( receiver *rx, size_t *nsamples_outp );
+
+/* returns 1 when the receiver is done (e.g. --rx-one), else 0 */
+int
+receiver_commit_read( receiver *rx, size_t nsamples );
+
+/* copying convenience wrapper around get_read_buffer/commit_read */
+int
+receiver_process( receiver *rx, const float *samples, size_t nsamples );
+
+/* end of input stream: decode what remains and report NOCARRIER */
+void
+receiver_finish( receiver *rx );
+
+/* read sa to end of input (or *stopp), then receiver_finish() */
+int
+receiver_read_audio( receiver *rx, simpleaudio *sa, volatile sig_atomic_t *stopp );
+
+/*
+ * --stats: report the receiver's hot-path counters and timings as
+ * "### STATS ..." lines.  receiver_finish() reports them too, and so does
+ * receiver_read_audio() whenever receiver_stats_requested gets set (e.g.
+ * by a SIGUSR1 handler).  Does nothing unless cfg->stats is set.
+ */
+void
+receiver_report_stats( receiver *rx );
+
+struct receiver_stats {
+	unsigned long long	start_ns;
+	unsigned long long	read_calls;	// simpleaudio_read()
+	unsigned long long	read_wait_ns;
+	fsk_stats		search;		// coarse fsk_find_frame() scans
+	fsk_stats		refine;		// ... and the fine rescans
+	fsk_stats		detect;		// carrier autodetection
+	unsigned long long	frames_decoded;
+	unsigned long long	idle_nsamples_skipped;
+	unsigned long long	output_writes;
+	unsigned long long	output_ns;
+};
+
+/* the counts so far, or NULL unless cfg->stats */
+const struct receiver_stats *
+receiver_get_stats( receiver *rx );
+
+extern volatile sig_atomic_t receiver_stats_requested;
+
+#endif
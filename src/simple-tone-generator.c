@@ -19,106 +19,335 @@
 
 
 #include <math.h>
+#include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "simpleaudio.h"
+#include "simpleaudio_internal.h"
 
 
+/*
+ * The tone generator is a numerically controlled oscillator: the phase is
+ * a 32-bit fraction of a turn, advanced by a fixed increment per sample and
+ * wrapping for free.  With a power-of-two table the table index is just
+ * the top bits of the (rounded) phase; any other table size takes a 32x32
+ * multiply instead.  Either way there is no float->int conversion, no '%'
+ * and no fmodf() per sample.
+ *
+ * Samples are made in blocks of TONE_BLOCK: first the block's phases and
+ * table indices (straight-line integer math, which the compiler turns into
+ * SIMD code), then the table lookups.
+ */
 
-static float tone_mag = 1.0;
+#define TONE_BLOCK	16
 
-static unsigned int sin_table_len;
-static short *sin_table_short;
-static float *sin_table_float;
+#define PHASE_TURN	4294967296.0	// 2^32: one turn of phase
 
-void
-simpleaudio_tone_init( unsigned int new_sin_table_len, float mag )
+/*
+ * Bit waveform templates.  A tone of a given frequency and length, started
+ * at a given phase, is always the same waveform: so with a power-of-two sin
+ * table in use, a tone generator keeps the short tones that it makes (one
+ * waveform per quantized starting phase, each made when first needed), and
+ * after that just copies them.  The exact phase is still carried from tone
+ * to tone, so the quantization never accumulates.
+ *
+ * The quantization is the table's own resolution (1/len turn) if the
+ * tone's waveforms fit in TONE_TEMPLATE_MAX_BYTES that way, else as coarse
+ * as 1/TONE_TEMPLATE_MIN_NPHASES turn, and the templates of a generator
+ * take at most TONE_TEMPLATE_BUDGET in all.  Tones which do not fit (e.g.
+ * the long bits of rtty) are synthesized every time.
+ *
+ * A template is one sample longer than the tone it was made for, so that
+ * it also serves the tone of that length + 1: the fractional bit clock
+ * alternates between the two.
+ */
+
+#define TONE_TEMPLATE_MAX_NPHASES	4096	// the default sin table's len
+#define TONE_TEMPLATE_MIN_NPHASES	1024
+#define TONE_TEMPLATE_MAX_BYTES		(512*1024)
+#define TONE_TEMPLATE_BUDGET		(2*1024*1024)
+#define TONE_TEMPLATE_MAX		8	// e.g. mark, space, stop bits
+
+struct tone_template {
+	sa_format_t	format;
+	uint32_t	dphase;
+	size_t		nsamples;
+	unsigned int	phase_shift;	// 32 - log2(nphases)
+	void		*samples;	// nphases waveforms
+	unsigned char	made[TONE_TEMPLATE_MAX_NPHASES];
+};
+
+struct sa_sine_table {
+	unsigned int	len;
+	unsigned int	shift;		// 32 - log2(len), or 0
+	short		*s16;		// full scale
+	float		*f;		// unit amplitude
+};
+
+struct sa_tone_generator {
+	const sa_sine_table *table;	// or NULL to use sinf()
+	float		mag;
+	int		mag_q15;	// mag for table->s16, in 1/32768ths
+	unsigned short	mag_s;		// full scale for sinf() S16 samples
+	uint32_t	phase;		// "current" phase, in 2^-32 turns
+	struct tone_template templates[TONE_TEMPLATE_MAX];
+	unsigned int	ntemplates;
+	size_t		template_bytes;	// of TONE_TEMPLATE_BUDGET
+	void		*buf;		// for simpleaudio_tone()
+	size_t		buf_size;	// (reused, and only grown)
+	unsigned long	nallocs;	// of templates and buf
+};
+
+
+sa_sine_table *
+sa_sine_table_new( unsigned int len )
 {
-    sin_table_len = new_sin_table_len;
-    tone_mag = mag;
+    assert( len > 0 );
+    sa_sine_table *table = calloc(1, sizeof(*table));
+    if ( table ) {
+	table->s16 = malloc(len * sizeof(short));
+	table->f = malloc(len * sizeof(float));
+    }
+    if ( !table || !table->s16 || !table->f ) {
+	perror("malloc");
+	assert(0);
+    }
+    table->len = len;
 
-    if ( sin_table_len != 0 ) {
-	sin_table_short = realloc(sin_table_short, sin_table_len * sizeof(short));
-	sin_table_float = realloc(sin_table_float, sin_table_len * sizeof(float));
-	if ( !sin_table_short || !sin_table_float ) {
-	    perror("malloc");
-	    assert(0);
-	}
+    if ( len >= 2 && (len & (len-1)) == 0 ) {
+	table->shift = 32;
+	while ( (1U << (32 - table->shift)) < len )
+	    table->shift--;
+    }
 
-	unsigned int i;
-	unsigned short mag_s = 32767.0f * tone_mag + 0.5f;
-	if ( tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
-	    mag_s = 32767;
-	if ( mag_s < 1 ) // "short epsilon"
-	    mag_s = 1;
-	for ( i=0; i<sin_table_len; i++ )
-	    sin_table_short[i] = lroundf( mag_s * sinf((float)M_PI*2*i/sin_table_len) );
-	for ( i=0; i<sin_table_len; i++ )
-	    sin_table_float[i] = tone_mag * sinf((float)M_PI*2*i/sin_table_len);
+    unsigned int i;
+    for ( i=0; i<len; i++ ) {
+	table->f[i] = sinf((float)M_PI*2*i/len);
+	table->s16[i] = lroundf( 32767 * table->f[i] );
+    }
+    return table;
+}
 
-    } else {
-	if ( sin_table_short ) {
-	    free(sin_table_short);
-	    sin_table_short = NULL;
-	}
-	if ( sin_table_float ) {
-	    free(sin_table_float);
-	    sin_table_float = NULL;
-	}
+void
+sa_sine_table_destroy( sa_sine_table *table )
+{
+    free(table->s16);
+    free(table->f);
+    free(table);
+}
+
+
+sa_tone_generator *
+sa_tone_generator_new( const sa_sine_table *table, float mag )
+{
+    sa_tone_generator *tg = calloc(1, sizeof(*tg));
+    if ( !tg ) {
+	perror("malloc");
+	return NULL;
     }
+    tg->table = table;
+    tg->mag = mag;
+
+    tg->mag_q15 = 32768.0f * mag + 0.5f;
+    if ( mag > 1.0f ) // clamp to 1.0 to avoid overflow
+	tg->mag_q15 = 32768;
+    if ( tg->mag_q15 < 1 )
+	tg->mag_q15 = 1;
+
+    tg->mag_s = 32767.0f * mag + 0.5f;
+    if ( mag > 1.0f ) // clamp to 1.0 to avoid overflow
+	tg->mag_s = 32767;
+    if ( tg->mag_s < 1 ) // "short epsilon"
+	tg->mag_s = 1;
+
+    return tg;
 }
 
-/*
- * in: turns (0.0 to 1.0)    out: (-32767 to +32767)
- */
-static inline short
-sin_lu_short( float turns )
+void
+sa_tone_generator_destroy( sa_tone_generator *tg )
+{
+    unsigned int i;
+    for ( i=0; i<tg->ntemplates; i++ )
+	free(tg->templates[i].samples);
+    free(tg->buf);
+    free(tg);
+}
+
+void
+sa_tone_generator_reset( sa_tone_generator *tg )
+{
+    tg->phase = 0;
+}
+
+unsigned long
+sa_tone_generator_get_nallocs( sa_tone_generator *tg )
 {
-    int t = (float)sin_table_len * turns + 0.5f;
-    t %= sin_table_len;
-    return sin_table_short[t];
+    return tg->nallocs;
+}
+
+
+/* phase -> index into a sin table of any size (rounded to the nearest) */
+static inline uint32_t
+sin_lu_index( const sa_sine_table *table, uint32_t phase )
+{
+    uint32_t t = ((uint64_t)phase * table->len + 0x80000000U) >> 32;
+    return t < table->len ? t : 0;
 }
 
 /*
- * in: turns (0.0 to 1.0)    out: -1.0 to +1.0
+ * Table indices for the TONE_BLOCK samples from phase, where lane[j] is
+ * j * dphase.  (At the end of a tone the caller uses only the first few.)
  */
-static inline float
-sin_lu_float( float turns )
+static inline void
+tone_indices( const sa_sine_table *table, uint32_t *idx, uint32_t phase,
+	const uint32_t *lane )
+{
+    unsigned int j;
+    if ( table->shift ) {
+	unsigned int shift = table->shift;
+	phase += 1U << (shift-1);
+	for ( j=0; j<TONE_BLOCK; j++ )
+	    idx[j] = (phase + lane[j]) >> shift;
+    } else {
+	for ( j=0; j<TONE_BLOCK; j++ )
+	    idx[j] = sin_lu_index(table, phase + lane[j]);
+    }
+}
+
+static void
+tone_synth_short( sa_tone_generator *tg, short *buf, size_t nsamples,
+	uint32_t phase, uint32_t dphase )
+{
+    const short *s16 = tg->table->s16;
+    int q = tg->mag_q15;
+    uint32_t lane[TONE_BLOCK], idx[TONE_BLOCK];
+    size_t i, j, n;
+    for ( j=0; j<TONE_BLOCK; j++ )
+	lane[j] = (uint32_t)j * dphase;
+    for ( i=0; i<nsamples; i+=n ) {
+	n = nsamples - i < TONE_BLOCK ? nsamples - i : TONE_BLOCK;
+	tone_indices(tg->table, idx, phase, lane);
+	for ( j=0; j<n; j++ )
+	    buf[i+j] = (s16[idx[j]] * q + (1 << 14)) >> 15;
+	phase += TONE_BLOCK * dphase;
+    }
+}
+
+static void
+tone_synth_float( sa_tone_generator *tg, float *buf, size_t nsamples,
+	uint32_t phase, uint32_t dphase )
 {
-    int t = (float)sin_table_len * turns + 0.5f;
-    t %= sin_table_len;
-    return sin_table_float[t];
+    const float *f = tg->table->f;
+    float mag = tg->mag;
+    uint32_t lane[TONE_BLOCK], idx[TONE_BLOCK];
+    size_t i, j, n;
+    for ( j=0; j<TONE_BLOCK; j++ )
+	lane[j] = (uint32_t)j * dphase;
+    for ( i=0; i<nsamples; i+=n ) {
+	n = nsamples - i < TONE_BLOCK ? nsamples - i : TONE_BLOCK;
+	tone_indices(tg->table, idx, phase, lane);
+	for ( j=0; j<n; j++ )
+	    buf[i+j] = mag * f[idx[j]];
+	phase += TONE_BLOCK * dphase;
+    }
 }
 
 
-/* "current" phase state of the tone generator */
-static float sa_tone_cphase = 0.0;
+/* the template for this tone, or NULL if there is no room for it */
+static struct tone_template *
+tone_template_get( sa_tone_generator *tg, sa_format_t format,
+	unsigned int framesize, uint32_t dphase, size_t nsamples )
+{
+    struct tone_template *t;
+    unsigned int i;
+    for ( i=0; i<tg->ntemplates; i++ ) {
+	t = &tg->templates[i];
+	if ( t->dphase == dphase && t->format == format
+		&& t->nsamples >= nsamples && t->nsamples <= nsamples + 1 )
+	    return t;
+    }
+    if ( tg->ntemplates == TONE_TEMPLATE_MAX )
+	return NULL;
+
+    size_t waveform_bytes = (nsamples + 1) * framesize;
+    unsigned int nphases = tg->table->len;
+    while ( nphases > TONE_TEMPLATE_MIN_NPHASES
+		&& nphases * waveform_bytes > TONE_TEMPLATE_MAX_BYTES )
+	nphases /= 2;
+    size_t nbytes = nphases * waveform_bytes;
+    if ( nbytes > TONE_TEMPLATE_MAX_BYTES
+		|| tg->template_bytes + nbytes > TONE_TEMPLATE_BUDGET )
+	return NULL;
+
+    t = &tg->templates[tg->ntemplates];
+    t->samples = malloc(nbytes);
+    if ( !t->samples )
+	return NULL;
+    tg->nallocs++;
+    tg->template_bytes += nbytes;
+    t->format = format;
+    t->dphase = dphase;
+    t->nsamples = nsamples + 1;
+    t->phase_shift = 32;
+    while ( (1U << (32 - t->phase_shift)) < nphases )
+	t->phase_shift--;
+    bzero(t->made, sizeof(t->made));
+    tg->ntemplates++;
+    return t;
+}
 
-void
-simpleaudio_tone_reset()
+static void
+tone_template_fill( sa_tone_generator *tg, struct tone_template *t,
+	void *buf, unsigned int framesize, uint32_t phase, size_t nsamples )
 {
-    sa_tone_cphase = 0.0;
+    unsigned int shift = t->phase_shift;
+    unsigned int k = (uint32_t)(phase + (1U << (shift-1))) >> shift;
+    void *waveform = (char *)t->samples + k * t->nsamples * framesize;
+    if ( !t->made[k] ) {
+	uint32_t start = (uint32_t)k << shift;
+	if ( t->format == SA_SAMPLE_FORMAT_FLOAT )
+	    tone_synth_float(tg, waveform, t->nsamples, start, t->dphase);
+	else
+	    tone_synth_short(tg, waveform, t->nsamples, start, t->dphase);
+	t->made[k] = 1;
+    }
+    memcpy(buf, waveform, nsamples * framesize);
 }
 
+
 void
-simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
+sa_tone_generator_fill( sa_tone_generator *tg, simpleaudio *sa_out,
+		void *buf, float tone_freq, size_t nsamples_dur )
 {
     unsigned int framesize = simpleaudio_get_framesize(sa_out);
 
-    void *buf = malloc(nsamples_dur * framesize);
-    assert(buf);
-
     if ( tone_freq != 0 ) {
 
-	float wave_nsamples = simpleaudio_get_rate(sa_out) / tone_freq;
+	double turns_per_sample = fmod(tone_freq / simpleaudio_get_rate(sa_out), 1.0);
+	if ( turns_per_sample < 0 )
+	    turns_per_sample += 1.0;
+	uint32_t dphase = (uint64_t)llround(turns_per_sample * PHASE_TURN);
 	size_t i;
 
+	struct tone_template *t;
+	if ( tg->table && tg->table->shift
+		&& tg->table->len <= TONE_TEMPLATE_MAX_NPHASES
+		&& (t = tone_template_get(tg, simpleaudio_get_format(sa_out),
+				framesize, dphase, nsamples_dur)) ) {
+	    tone_template_fill(tg, t, buf, framesize, tg->phase, nsamples_dur);
+	    tg->phase += (uint32_t)nsamples_dur * dphase;
+	    return;
+	}
+
 #define TURNS_TO_RADIANS(t)	( (float)M_PI*2 * (t) )
 
-#define SINE_PHASE_TURNS	( (float)i/wave_nsamples + sa_tone_cphase )
+#define PHASE_TO_TURNS(p)	( (float)(uint32_t)(p) * (float)(1.0/PHASE_TURN) )
+
+#define SINE_PHASE_TURNS	PHASE_TO_TURNS(tg->phase + (uint32_t)i * dphase)
 #define SINE_PHASE_RADIANS	TURNS_TO_RADIANS(SINE_PHASE_TURNS)
 
 	switch ( simpleaudio_get_format(sa_out) ) {
@@ -126,12 +355,11 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 	    case SA_SAMPLE_FORMAT_FLOAT:
 		{
 		    float *float_buf = buf;
-		    if ( sin_table_float ) {
-			for ( i=0; i<nsamples_dur; i++ )
-			    float_buf[i] = sin_lu_float(SINE_PHASE_TURNS);
+		    if ( tg->table ) {
+			tone_synth_float(tg, float_buf, nsamples_dur, tg->phase, dphase);
 		    } else {
 			for ( i=0; i<nsamples_dur; i++ )
-			    float_buf[i] = tone_mag * sinf(SINE_PHASE_RADIANS);
+			    float_buf[i] = tg->mag * sinf(SINE_PHASE_RADIANS);
 		    }
 		}
 		break;
@@ -139,17 +367,11 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 	    case SA_SAMPLE_FORMAT_S16:
 		{
 		    short *short_buf = buf;
-		    if ( sin_table_short ) {
-			for ( i=0; i<nsamples_dur; i++ )
-			    short_buf[i] = sin_lu_short(SINE_PHASE_TURNS);
+		    if ( tg->table ) {
+			tone_synth_short(tg, short_buf, nsamples_dur, tg->phase, dphase);
 		    } else {
-			unsigned short mag_s = 32767.0f * tone_mag + 0.5f;
-			if ( tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
-			    mag_s = 32767;
-			if ( mag_s < 1 ) // "short epsilon"
-			    mag_s = 1;
 			for ( i=0; i<nsamples_dur; i++ )
-			    short_buf[i] = lroundf( mag_s * sinf(SINE_PHASE_RADIANS) );
+			    short_buf[i] = lroundf( tg->mag_s * sinf(SINE_PHASE_RADIANS) );
 		    }
 		    break;
 		}
@@ -159,18 +381,77 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 		break;
 	}
 
-	sa_tone_cphase
-	    = fmodf(sa_tone_cphase + (float)nsamples_dur/wave_nsamples, 1.0);
+	tg->phase += (uint32_t)nsamples_dur * dphase;
 
     } else {
 
 	bzero(buf, nsamples_dur * framesize);
-	sa_tone_cphase = 0.0;
+	tg->phase = 0;
+
+    }
+}
+
+
+/*
+ * The simpleaudio_tone*() calls use the stream's own tone generator, made
+ * at simpleaudio_open_stream() from the simpleaudio_tone_init() settings.
+ */
 
+static sa_sine_table *default_sine_table;
+static float default_tone_mag = 1.0;
+
+void
+simpleaudio_tone_init( unsigned int new_sin_table_len, float mag )
+{
+    if ( default_sine_table ) {
+	sa_sine_table_destroy(default_sine_table);
+	default_sine_table = NULL;
     }
+    if ( new_sin_table_len != 0 )
+	default_sine_table = sa_sine_table_new(new_sin_table_len);
+    default_tone_mag = mag;
+}
+
+sa_tone_generator *
+simpleaudio_tone_generator_new_default()
+{
+    return sa_tone_generator_new(default_sine_table, default_tone_mag);
+}
 
-    assert ( simpleaudio_write(sa_out, buf, nsamples_dur) > 0 );
+sa_tone_generator *
+simpleaudio_get_tone_generator( simpleaudio *sa_out )
+{
+    return sa_out->tone_generator;
+}
 
-    free(buf);
+void
+simpleaudio_tone_reset( simpleaudio *sa_out )
+{
+    sa_tone_generator_reset(sa_out->tone_generator);
 }
 
+void
+simpleaudio_tone_fill(simpleaudio *sa_out, void *buf,
+		float tone_freq, size_t nsamples_dur)
+{
+    sa_tone_generator_fill(sa_out->tone_generator, sa_out,
+	    buf, tone_freq, nsamples_dur);
+}
+
+void
+simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
+{
+    sa_tone_generator *tg = sa_out->tone_generator;
+
+    size_t size = nsamples_dur * simpleaudio_get_framesize(sa_out);
+    if ( tg->buf_size < size ) {
+	tg->buf = realloc(tg->buf, size);
+	assert(tg->buf);
+	tg->buf_size = size;
+	tg->nallocs++;
+    }
+
+    sa_tone_generator_fill(tg, sa_out, tg->buf, tone_freq, nsamples_dur);
+
+    assert ( simpleaudio_write(sa_out, tg->buf, nsamples_dur) > 0 );
+}
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <alsa/asoundlib.h>
 
@@ -35,14 +36,161 @@
 
 /*
  * ALSA backend for simpleaudio
+ *
+ * The PCM is opened for plain read/write access (snd_pcm_readi/writei) in
+ * the stream's own format, which is one copy to or from the driver's ring
+ * buffer; the "plug" and other software PCMs convert as needed.  Only a
+ * device which does not take that format (a raw "hw" device, whose native
+ * format is some other) is opened for mmap access in a format it does
+ * take: then the samples are converted straight between the ring buffer
+ * (as exposed by snd_pcm_mmap_begin/commit) and the caller's buffer, still
+ * touching each one once, where read/write access would need a copy into
+ * a staging buffer and another pass to convert.
  */
 
+struct alsa_data {
+    snd_pcm_t		*pcm;
+    int			mmap;
+    sa_format_t		hw_format;	// the ring buffer's, if mmap
+};
+
+
+/*
+ * The address of frame "offset" in the ring buffer.  The areas of an
+ * interleaved PCM all share a buffer, and only the first one's is needed.
+ */
+static char *
+sa_alsa_mmap_addr( const snd_pcm_channel_area_t *areas,
+	snd_pcm_uframes_t offset )
+{
+    return (char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+}
+
+static ssize_t
+sa_alsa_mmap_read( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct alsa_data *d = sa->backend_handle;
+    snd_pcm_t *pcm = d->pcm;
+    size_t frames_read = 0;
+    while ( frames_read < nframes ) {
+	if ( snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED )
+	    snd_pcm_start(pcm);
+
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+	int r = avail < 0 ? avail : 0;
+	if ( avail == 0 ) {
+	    if ( sa->nonblock ) {
+		if ( frames_read )
+		    break;
+		errno = EAGAIN;
+		return -1;
+	    }
+	    r = snd_pcm_wait(pcm, 1000);
+	    if ( r >= 0 )
+		continue;
+	}
+
+	if ( r == 0 ) {
+	    const snd_pcm_channel_area_t *areas;
+	    snd_pcm_uframes_t offset;
+	    snd_pcm_uframes_t frames = nframes - frames_read;
+	    if ( frames > (snd_pcm_uframes_t)avail )
+		frames = avail;
+	    r = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+	    if ( r == 0 ) {
+		sa_convert_samples(buf + frames_read*sa->backend_framesize,
+			sa->format,
+			sa_alsa_mmap_addr(areas, offset), d->hw_format,
+			frames * sa->channels);
+		snd_pcm_sframes_t c = snd_pcm_mmap_commit(pcm, offset, frames);
+		if ( c >= 0 && (snd_pcm_uframes_t)c != frames )
+		    c = -EPIPE;
+		r = c < 0 ? c : 0;
+		if ( r == 0 ) {
+		    frames_read += frames;
+		    continue;
+		}
+	    }
+	}
+
+	if ( r == -EPIPE ) {	// Overrun
+	    fprintf(stderr, "#");
+	    snd_pcm_prepare(pcm);
+	} else if ( snd_pcm_recover(pcm, r, 0 /*silent*/) < 0 ) {
+	    fprintf(stderr, "E: %s\n", snd_strerror(r));
+	    return -1;
+	}
+    }
+    return frames_read;
+}
+
+static ssize_t
+sa_alsa_mmap_write( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct alsa_data *d = sa->backend_handle;
+    snd_pcm_t *pcm = d->pcm;
+    size_t frames_written = 0;
+    while ( frames_written < nframes ) {
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+	int r = avail < 0 ? avail : 0;
+	if ( avail == 0 ) {
+	    // the ring is full: it plays once started
+	    if ( snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED )
+		snd_pcm_start(pcm);
+	    if ( sa->nonblock ) {
+		if ( frames_written )
+		    break;
+		errno = EAGAIN;
+		return -1;
+	    }
+	    r = snd_pcm_wait(pcm, 1000);
+	    if ( r >= 0 )
+		continue;
+	}
+
+	if ( r == 0 ) {
+	    const snd_pcm_channel_area_t *areas;
+	    snd_pcm_uframes_t offset;
+	    snd_pcm_uframes_t frames = nframes - frames_written;
+	    if ( frames > (snd_pcm_uframes_t)avail )
+		frames = avail;
+	    r = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+	    if ( r == 0 ) {
+		sa_convert_samples(sa_alsa_mmap_addr(areas, offset),
+			d->hw_format,
+			buf + frames_written*sa->backend_framesize, sa->format,
+			frames * sa->channels);
+		snd_pcm_sframes_t c = snd_pcm_mmap_commit(pcm, offset, frames);
+		if ( c >= 0 && (snd_pcm_uframes_t)c != frames )
+		    c = -EPIPE;
+		r = c < 0 ? c : 0;
+		if ( r == 0 ) {
+		    frames_written += frames;
+		    continue;
+		}
+	    }
+	}
+
+	if ( r == -EPIPE )
+	    sa->underruns++;
+	if ( snd_pcm_recover(pcm, r, 1 /*silent*/) < 0 ) {
+	    fprintf(stderr, "E: %s\n", snd_strerror(r));
+	    return -1;
+	}
+    }
+    return frames_written;
+}
+
 
 static ssize_t
 sa_alsa_read( simpleaudio *sa, void *buf, size_t nframes )
 {
+    struct alsa_data *d = sa->backend_handle;
+    if ( d->mmap )
+	return sa_alsa_mmap_read(sa, buf, nframes);
+
     ssize_t frames_read = 0;
-    snd_pcm_t *pcm = (snd_pcm_t *)sa->backend_handle;
+    snd_pcm_t *pcm = d->pcm;
     while ( frames_read < nframes ) {
 	ssize_t r;
 	void * data = buf+frames_read*sa->backend_framesize;
@@ -50,10 +198,18 @@ sa_alsa_read( simpleaudio *sa, void *buf, size_t nframes )
 	r = snd_pcm_readi(pcm, data, count);
 	if ( r >= 0 ) {
 	    frames_read += r;
+	    if ( sa->nonblock )
+		break;		// whatever was there
 	    if ( r != count )
 		fprintf(stderr, "#short+%zd#\n", r);
 	    continue;
 	}
+	if ( r == -EAGAIN && sa->nonblock ) {
+	    if ( frames_read )
+		break;
+	    errno = EAGAIN;
+	    return -1;
+	}
 	if (r == -EPIPE) {	// Underrun
 	    fprintf(stderr, "#");
 	    snd_pcm_prepare(pcm);
@@ -73,12 +229,24 @@ sa_alsa_read( simpleaudio *sa, void *buf, size_t nframes )
 static ssize_t
 sa_alsa_write( simpleaudio *sa, void *buf, size_t nframes )
 {
+    struct alsa_data *d = sa->backend_handle;
+    if ( d->mmap )
+	return sa_alsa_mmap_write(sa, buf, nframes);
+
     ssize_t frames_written = 0;
-    snd_pcm_t *pcm = (snd_pcm_t *)sa->backend_handle;
+    snd_pcm_t *pcm = d->pcm;
     while ( frames_written < nframes ) {
 	ssize_t r;
 	r = snd_pcm_writei(pcm, buf+frames_written*sa->backend_framesize, nframes-frames_written);
+	if ( r == -EAGAIN && sa->nonblock ) {
+	    if ( frames_written )
+		break;
+	    errno = EAGAIN;
+	    return -1;
+	}
 	if (r < 0) {
+	    if ( r == -EPIPE )
+		sa->underruns++;
 	    /* recover from e.g. underruns, and try once more */
 	    snd_pcm_recover(pcm, r, 0 /*silent*/);
 	    r = snd_pcm_writei(pcm, buf+frames_written*sa->backend_framesize, nframes-frames_written);
@@ -88,17 +256,92 @@ sa_alsa_write( simpleaudio *sa, void *buf, size_t nframes )
 	    return -1;
 	}
 	frames_written += r;
+	if ( sa->nonblock )
+	    break;		// as much as would go
     }
-    assert (frames_written == nframes);
+    assert (frames_written == nframes || sa->nonblock);
     return frames_written;
 }
 
 
+static int
+sa_alsa_set_nonblock( simpleaudio *sa, int nonblock )
+{
+    struct alsa_data *d = sa->backend_handle;
+    return snd_pcm_nonblock(d->pcm, nonblock) < 0 ? -1 : 0;
+}
+
+static int
+sa_alsa_poll_descriptors( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int space )
+{
+    struct alsa_data *d = sa->backend_handle;
+    if ( !pfds )
+	return snd_pcm_poll_descriptors_count(d->pcm);
+    return snd_pcm_poll_descriptors(d->pcm, pfds, space);
+}
+
+static int
+sa_alsa_poll_ready( simpleaudio *sa, struct pollfd *pfds, unsigned int nfds )
+{
+    struct alsa_data *d = sa->backend_handle;
+    unsigned short revents;
+    if ( snd_pcm_poll_descriptors_revents(d->pcm,
+		pfds, nfds, &revents) < 0 )
+	return 1;	// let the read or write report the error
+    return revents != 0;
+}
+
+
 static void
 sa_alsa_close( simpleaudio *sa )
 {
-    snd_pcm_drain(sa->backend_handle);
-    snd_pcm_close(sa->backend_handle);
+    struct alsa_data *d = sa->backend_handle;
+    if ( sa->nonblock )
+	snd_pcm_nonblock(d->pcm, 0);	// or drain won't wait
+    snd_pcm_drain(d->pcm);
+    snd_pcm_close(d->pcm);
+    free(d);
+}
+
+static snd_pcm_format_t
+sa_alsa_pcm_format( sa_format_t format )
+{
+    switch ( format ) {
+	case SA_SAMPLE_FORMAT_FLOAT:	return SND_PCM_FORMAT_FLOAT;
+	case SA_SAMPLE_FORMAT_S16:	return SND_PCM_FORMAT_S16;
+	case SA_SAMPLE_FORMAT_S24:	return SND_PCM_FORMAT_S24_3LE;
+	case SA_SAMPLE_FORMAT_S32:	return SND_PCM_FORMAT_S32;
+	case SA_SAMPLE_FORMAT_U8:	return SND_PCM_FORMAT_U8;
+    }
+    assert(0);
+    return SND_PCM_FORMAT_UNKNOWN;
+}
+
+/*
+ * Ring buffer formats to try for mmap access, when the device does not
+ * take the stream's own
+ */
+static const sa_format_t sa_alsa_mmap_formats[] = {
+    SA_SAMPLE_FORMAT_S32,
+    SA_SAMPLE_FORMAT_S24,
+    SA_SAMPLE_FORMAT_S16,
+    SA_SAMPLE_FORMAT_FLOAT,
+    SA_SAMPLE_FORMAT_U8,
+};
+
+
+static int
+sa_alsa_set_params( struct alsa_data *d, snd_pcm_access_t access,
+	unsigned int channels, unsigned int rate )
+{
+    return snd_pcm_set_params(d->pcm,
+		sa_alsa_pcm_format(d->hw_format),
+		access,
+		channels,
+		rate,
+		1 /* soft_resample (allow) */,
+		simpleaudio_latency_us);
 }
 
 static int
@@ -135,30 +378,35 @@ sa_alsa_open_stream(
 	return 0;
     }
 
-    snd_pcm_format_t pcm_format;
-
-    switch ( sa->format ) {
-	case SA_SAMPLE_FORMAT_FLOAT:
-		pcm_format = SND_PCM_FORMAT_FLOAT;
-		break;
-	case SA_SAMPLE_FORMAT_S16:
-		pcm_format = SND_PCM_FORMAT_S16;
-		break;
-	default:
-		assert(0);
+    struct alsa_data *d = calloc(1, sizeof(struct alsa_data));
+    if ( !d ) {
+	perror("calloc");
+	snd_pcm_close(pcm);
+	return 0;
     }
+    d->pcm = pcm;
 
-    /* set up ALSA hardware params */
-    error = snd_pcm_set_params(pcm,
-		pcm_format,
-		SND_PCM_ACCESS_RW_INTERLEAVED,
-		channels,
-		rate,
-		1 /* soft_resample (allow) */,
-		100000 /* latency (us) */);
+    /* set up ALSA hardware params: in the stream's format if we can */
+    d->hw_format = sa->format;
+    error = sa_alsa_set_params(d, SND_PCM_ACCESS_RW_INTERLEAVED,
+		channels, rate);
+
+    /* else in the device's own format, converting from its mmap area */
+    unsigned int i;
+    for ( i=0; error && i<sizeof(sa_alsa_mmap_formats)/sizeof(sa_alsa_mmap_formats[0]); i++ ) {
+	if ( sa_alsa_mmap_formats[i] == sa->format )
+	    continue;
+	d->hw_format = sa_alsa_mmap_formats[i];
+	if ( sa_alsa_set_params(d, SND_PCM_ACCESS_MMAP_INTERLEAVED,
+		    channels, rate) == 0 ) {
+	    d->mmap = 1;
+	    error = 0;
+	}
+    }
     if (error) {
 	fprintf(stderr, "E: %s\n", snd_strerror(error));
 	snd_pcm_close(pcm);
+	free(d);
 	return 0;
     }
 
@@ -182,7 +430,7 @@ sa_alsa_open_stream(
     }
 #endif
 
-    sa->backend_handle = pcm;
+    sa->backend_handle = d;
     sa->backend_framesize = sa->channels * sa->samplesize; 
 
     return 1;
@@ -194,6 +442,10 @@ const struct simpleaudio_backend simpleaudio_backend_alsa = {
     sa_alsa_read,
     sa_alsa_write,
     sa_alsa_close,
+    NULL /* map */,
+    sa_alsa_set_nonblock,
+    sa_alsa_poll_descriptors,
+    sa_alsa_poll_ready,
 };
 
 #endif /* USE_ALSA */
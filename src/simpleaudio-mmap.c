@@ -0,0 +1,261 @@
+/*
+ * simpleaudio-mmap.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "simpleaudio.h"
+#include "simpleaudio_internal.h"
+
+
+/*
+ * memory-mapped file backend for simpleaudio (record only)
+ *
+ * backend_device is either the path of an uncompressed WAV file (8, 16,
+ * 24 or 32-bit PCM, or 32-bit float), or "{s16|s24|s32|u8|float}:{path}"
+ * for a headerless file.  The file is mapped, and read straight out of the
+ * page cache, converted into the stream's format on the way (see
+ * sa_convert_samples()); when the samples are already in the stream's
+ * format simpleaudio_map() hands out the mapping itself.
+ *
+ * Opening fails without any message for anything else (other file types,
+ * pipes, a channel count other than the one requested, a big-endian host),
+ * so that callers can quietly fall back to the sndfile or raw backend.
+ */
+
+struct mmap_data {
+    void		*map;
+    size_t		map_len;
+    const char		*data;
+    size_t		nframes;
+    size_t		pos;
+    sa_format_t		data_format;
+    size_t		data_framesize;
+};
+
+
+static unsigned int
+le16( const unsigned char *p )
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t
+le32( const unsigned char *p )
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Find the data chunk of a RIFF/WAVE file.  Returns 1 and fills in
+ * the data offset, length and format if it is one we can handle.
+ */
+static int
+sa_mmap_parse_wav( const unsigned char *p, size_t len,
+	size_t *data_offp, size_t *data_lenp,
+	sa_format_t *formatp, unsigned int *ratep, unsigned int *channelsp )
+{
+    if ( len < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p+8, "WAVE", 4) != 0 )
+	return 0;
+
+    int have_fmt = 0;
+    size_t off = 12;
+    while ( off + 8 <= len ) {
+	const unsigned char *chunk = p + off;
+	size_t chunk_len = le32(chunk+4);
+	off += 8;
+
+	if ( memcmp(chunk, "fmt ", 4) == 0 ) {
+	    if ( chunk_len < 16 || off + chunk_len > len )
+		return 0;
+	    unsigned int tag = le16(chunk+8);
+	    unsigned int bits = le16(chunk+22);
+	    if ( tag == 0xFFFE ) {	// WAVE_FORMAT_EXTENSIBLE
+		if ( chunk_len < 40 )
+		    return 0;
+		tag = le16(chunk+32);	// first bytes of the SubFormat GUID
+	    }
+	    if ( tag == 1 && bits == 8 )
+		*formatp = SA_SAMPLE_FORMAT_U8;
+	    else if ( tag == 1 && bits == 16 )
+		*formatp = SA_SAMPLE_FORMAT_S16;
+	    else if ( tag == 1 && bits == 24 )
+		*formatp = SA_SAMPLE_FORMAT_S24;
+	    else if ( tag == 1 && bits == 32 )
+		*formatp = SA_SAMPLE_FORMAT_S32;
+	    else if ( tag == 3 && bits == 32 )
+		*formatp = SA_SAMPLE_FORMAT_FLOAT;
+	    else
+		return 0;
+	    *channelsp = le16(chunk+10);
+	    *ratep = le32(chunk+12);
+	    have_fmt = 1;
+	} else if ( memcmp(chunk, "data", 4) == 0 ) {
+	    if ( !have_fmt )
+		return 0;
+	    // tolerate a bogus (e.g. streamed, never patched) data length
+	    if ( chunk_len > len - off )
+		chunk_len = len - off;
+	    *data_offp = off;
+	    *data_lenp = chunk_len;
+	    return 1;
+	}
+
+	off += chunk_len + (chunk_len & 1);
+    }
+    return 0;
+}
+
+
+static ssize_t
+sa_mmap_read( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct mmap_data *d = sa->backend_handle;
+
+    if ( nframes > d->nframes - d->pos )
+	nframes = d->nframes - d->pos;
+
+    sa_convert_samples(buf, sa->format,
+		d->data + d->pos * d->data_framesize, d->data_format,
+		nframes * sa->channels);
+
+    d->pos += nframes;
+    return nframes;
+}
+
+static ssize_t
+sa_mmap_write( simpleaudio *sa, void *buf, size_t nframes )
+{
+    return -1;
+}
+
+static const void *
+sa_mmap_map( simpleaudio *sa, size_t *nframesp )
+{
+    struct mmap_data *d = sa->backend_handle;
+
+    if ( d->data_format != sa->format || sa->channels != 1 )
+	return NULL;
+    if ( (uintptr_t)d->data % sa->samplesize )
+	return NULL;	// e.g. a float WAV with an 18-byte fmt chunk
+
+    *nframesp = d->nframes - d->pos;
+    return d->data + d->pos * sa->backend_framesize;
+}
+
+static void
+sa_mmap_close( simpleaudio *sa )
+{
+    struct mmap_data *d = sa->backend_handle;
+    munmap(d->map, d->map_len);
+    free(d);
+}
+
+static int
+sa_mmap_open_stream(
+		simpleaudio *sa,
+		const char *backend_device,
+		sa_direction_t sa_stream_direction,
+		sa_format_t sa_format,
+		unsigned int rate, unsigned int channels,
+		char *app_name, char *stream_name )
+{
+    const unsigned short one = 1;
+    if ( *(const unsigned char *)&one != 1 )
+	return 0;	// the file data is little-endian
+    if ( sa_stream_direction != SA_STREAM_RECORD || !backend_device )
+	return 0;
+
+    sa_format_t data_format = sa_format;
+    const char *path = sa_device_format_prefix(backend_device, &data_format);
+    int is_raw = path != backend_device;
+
+    int fd = open(path, O_RDONLY);
+    if ( fd < 0 )
+	return 0;
+    struct stat st;
+    if ( fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ) {
+	close(fd);
+	return 0;
+    }
+    size_t map_len = st.st_size;
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED )
+	return 0;
+
+    size_t data_off = 0, data_len = map_len;
+    unsigned int file_rate = rate, file_channels = channels;
+    if ( !is_raw && !sa_mmap_parse_wav(map, map_len, &data_off, &data_len,
+		&data_format, &file_rate, &file_channels) )
+	goto fail;
+
+    if ( file_channels != channels || file_rate == 0 )
+	goto fail;
+
+    // the converters load whole samples (S24 goes a byte at a time)
+    unsigned int data_samplesize = sa_format_samplesize(data_format);
+    if ( data_format != sa_format && data_samplesize != 3
+	    && ((uintptr_t)map + data_off) % data_samplesize )
+	goto fail;
+
+    struct mmap_data *d = calloc(1, sizeof(struct mmap_data));
+    if ( !d )
+	goto fail;
+
+    d->map = map;
+    d->map_len = map_len;
+    d->data = (const char *)map + data_off;
+    d->data_format = data_format;
+    d->data_framesize = channels * data_samplesize;
+    d->nframes = data_len / d->data_framesize;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, map_len, MADV_SEQUENTIAL);
+#endif
+
+    sa->rate = file_rate;
+    sa->backend_handle = d;
+    sa->backend_framesize = sa->channels * sa->samplesize;
+
+    return 1;
+
+fail:
+    munmap(map, map_len);
+    return 0;
+}
+
+
+const struct simpleaudio_backend simpleaudio_backend_mmap = {
+    sa_mmap_open_stream,
+    sa_mmap_read,
+    sa_mmap_write,
+    sa_mmap_close,
+    sa_mmap_map,
+};
@@ -0,0 +1,394 @@
+/*
+ * simpleaudio-raw.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	// F_SETPIPE_SZ
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "simpleaudio.h"
+#include "simpleaudio_internal.h"
+
+
+/*
+ * raw (headerless) PCM backend for simpleaudio
+ *
+ * backend_device is "[{s16|s24|s32|u8|float}:]{path}", where path "-" (or
+ * a NULL backend_device) means stdin or stdout, and "fd:{n}" an already
+ * open descriptor (which is left open at close).  The prefix gives the
+ * sample format on the wire (default: the stream's own sa_format); any
+ * other wire format is converted to or from the stream's format through a
+ * small staging buffer (see sa_convert_samples()).
+ *
+ * In non-blocking mode, a frame split across reads (or writes) is carried
+ * over to the next call.
+ */
+
+// ask for big pipe buffers, so high-rate producers can move whole blocks
+#define SA_RAW_PIPE_SIZE	(1024*1024)
+
+// frames per conversion, small enough to stay in cache
+#define SA_RAW_STAGE_NFRAMES	4096
+
+struct raw_data {
+    int			fd;
+    int			close_fd;
+    sa_format_t		wire_format;
+    size_t		wire_framesize;
+    char		*stage;		// only if wire_format != sa->format
+    sa_direction_t	direction;
+    char		partial[32];	// the start of a frame read so far
+    size_t		npartial;
+    char		wpending[32];	// the rest of a frame partly written
+    size_t		nwpending;
+};
+
+
+// in blocking mode, wait out a descriptor which is non-blocking anyway
+static int
+sa_raw_wait( simpleaudio *sa, struct raw_data *d, short events )
+{
+    if ( sa->nonblock )
+	return 0;
+    struct pollfd pfd = { .fd = d->fd, .events = events };
+    while ( poll(&pfd, 1, -1) < 0 )
+	if ( errno != EINTR )
+	    return 0;
+    return 1;
+}
+
+/*
+ * Read whole frames, up to nbytes' worth, into buf: until there are that
+ * many or the input ends, or in non-blocking mode, whatever is there.
+ * Returns the number of bytes, or -1 (errno EAGAIN if there is not even
+ * one frame yet).
+ */
+static ssize_t
+sa_raw_read_frames( simpleaudio *sa, struct raw_data *d,
+	char *buf, size_t nbytes )
+{
+    size_t nread = d->npartial;
+    memcpy(buf, d->partial, nread);
+    d->npartial = 0;
+
+    int again = 0;
+    while ( nread < nbytes ) {
+	ssize_t n = read(d->fd, buf + nread, nbytes - nread);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+		if ( sa_raw_wait(sa, d, POLLIN) )
+		    continue;
+		again = 1;
+		break;
+	    }
+	    perror("read");
+	    return -1;
+	}
+	if ( n == 0 )
+	    break;	// end of input: drop any trailing partial frame
+	nread += n;
+    }
+
+    size_t partial = nread % d->wire_framesize;
+    nread -= partial;
+    if ( again ) {
+	memcpy(d->partial, buf + nread, partial);
+	d->npartial = partial;
+	if ( nread == 0 ) {
+	    errno = EAGAIN;
+	    return -1;
+	}
+    }
+    return nread;
+}
+
+/*
+ * Write nbytes of whole frames from buf: all of them, or in non-blocking
+ * mode as many as will go, taking the rest of a partly written frame to
+ * finish next time.  Returns the number of bytes taken, or -1 (errno
+ * EAGAIN if none would go).
+ */
+static ssize_t
+sa_raw_write_frames( simpleaudio *sa, struct raw_data *d,
+	const char *buf, size_t nbytes )
+{
+    while ( d->nwpending ) {
+	ssize_t n = write(d->fd, d->wpending, d->nwpending);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+		if ( sa_raw_wait(sa, d, POLLOUT) )
+		    continue;
+	    } else {
+		perror("write");
+	    }
+	    return -1;
+	}
+	d->nwpending -= n;
+	memmove(d->wpending, d->wpending + n, d->nwpending);
+    }
+
+    size_t nwritten = 0;
+    while ( nwritten < nbytes ) {
+	ssize_t n = write(d->fd, buf + nwritten, nbytes - nwritten);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+		if ( sa_raw_wait(sa, d, POLLOUT) )
+		    continue;
+		break;
+	    }
+	    perror("write");
+	    return -1;
+	}
+	nwritten += n;
+    }
+
+    size_t partial = nwritten % d->wire_framesize;
+    if ( partial ) {
+	d->nwpending = d->wire_framesize - partial;
+	memcpy(d->wpending, buf + nwritten, d->nwpending);
+	nwritten += d->nwpending;
+    }
+    if ( nwritten == 0 && nbytes ) {
+	errno = EAGAIN;
+	return -1;
+    }
+    return nwritten;
+}
+
+
+static ssize_t
+sa_raw_read( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct raw_data *d = sa->backend_handle;
+
+    // read straight into the caller's buffer
+    if ( d->wire_format == sa->format ) {
+	ssize_t nbytes = sa_raw_read_frames(sa, d, buf,
+					nframes * sa->backend_framesize);
+	if ( nbytes < 0 )
+	    return -1;
+	return nbytes / sa->backend_framesize;
+    }
+
+    // or read through the staging buffer, converting into the caller's
+    char *out = buf;
+    size_t nread = 0;
+    while ( nread < nframes ) {
+	size_t n = nframes - nread;
+	if ( n > SA_RAW_STAGE_NFRAMES )
+	    n = SA_RAW_STAGE_NFRAMES;
+	ssize_t nbytes = sa_raw_read_frames(sa, d, d->stage,
+					n * d->wire_framesize);
+	if ( nbytes < 0 ) {
+	    if ( errno == EAGAIN && nread )
+		break;
+	    return -1;
+	}
+	size_t got = nbytes / d->wire_framesize;
+	sa_convert_samples(out, sa->format, d->stage, d->wire_format,
+				got * sa->channels);
+	out += got * sa->backend_framesize;
+	nread += got;
+	if ( got < n )
+	    break;	// end of input, or no more for now
+    }
+    return nread;
+}
+
+static ssize_t
+sa_raw_write( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct raw_data *d = sa->backend_handle;
+
+    if ( d->wire_format == sa->format ) {
+	ssize_t nbytes = sa_raw_write_frames(sa, d, buf,
+					nframes * sa->backend_framesize);
+	if ( nbytes < 0 )
+	    return -1;
+	return nbytes / sa->backend_framesize;
+    }
+
+    const char *in = buf;
+    size_t nwritten = 0;
+    while ( nwritten < nframes ) {
+	size_t n = nframes - nwritten;
+	if ( n > SA_RAW_STAGE_NFRAMES )
+	    n = SA_RAW_STAGE_NFRAMES;
+	sa_convert_samples(d->stage, d->wire_format, in, sa->format,
+				n * sa->channels);
+	ssize_t nbytes = sa_raw_write_frames(sa, d, d->stage,
+					n * d->wire_framesize);
+	if ( nbytes < 0 ) {
+	    if ( errno == EAGAIN && nwritten )
+		break;
+	    return -1;
+	}
+	size_t put = nbytes / d->wire_framesize;
+	in += put * sa->backend_framesize;
+	nwritten += put;
+	if ( put < n )
+	    break;	// no more room for now
+    }
+    return nwritten;
+}
+
+static int
+sa_raw_set_nonblock( simpleaudio *sa, int nonblock )
+{
+    struct raw_data *d = sa->backend_handle;
+    int flags = fcntl(d->fd, F_GETFL);
+    if ( flags < 0 )
+	return -1;
+    flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(d->fd, F_SETFL, flags);
+}
+
+static int
+sa_raw_poll_descriptors( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int space )
+{
+    struct raw_data *d = sa->backend_handle;
+    if ( !pfds )
+	return 1;
+    if ( space < 1 )
+	return 0;
+    pfds[0].fd = d->fd;
+    pfds[0].events = d->direction == SA_STREAM_RECORD ? POLLIN : POLLOUT;
+    pfds[0].revents = 0;
+    return 1;
+}
+
+static int
+sa_raw_poll_ready( simpleaudio *sa, struct pollfd *pfds, unsigned int nfds )
+{
+    return nfds >= 1 && pfds[0].revents != 0;
+}
+
+static void
+sa_raw_close( simpleaudio *sa )
+{
+    struct raw_data *d = sa->backend_handle;
+    if ( d->nwpending ) {
+	// finish a partly written frame
+	sa->nonblock = 0;
+	sa_raw_write_frames(sa, d, NULL, 0);
+    }
+    if ( d->close_fd )
+	close(d->fd);
+    free(d->stage);
+    free(d);
+}
+
+static int
+sa_raw_open_stream(
+		simpleaudio *sa,
+		const char *backend_device,
+		sa_direction_t sa_stream_direction,
+		sa_format_t sa_format,
+		unsigned int rate, unsigned int channels,
+		char *app_name, char *stream_name )
+{
+    struct raw_data *d = calloc(1, sizeof(struct raw_data));
+    if ( !d ) {
+	perror("malloc");
+	return 0;
+    }
+
+    d->wire_format = sa_format;
+    const char *path = sa_device_format_prefix(
+		backend_device ? backend_device : "-", &d->wire_format);
+    d->wire_framesize = sa_format_samplesize(d->wire_format) * sa->channels;
+    d->direction = sa_stream_direction;
+    if ( d->wire_framesize > sizeof(d->partial) ) {
+	fprintf(stderr, "%s: too many channels\n", stream_name);
+	free(d);
+	return 0;
+    }
+    if ( d->wire_format != sa_format ) {
+	d->stage = malloc(SA_RAW_STAGE_NFRAMES * d->wire_framesize);
+	if ( !d->stage ) {
+	    perror("malloc");
+	    free(d);
+	    return 0;
+	}
+    }
+
+    if ( strcmp(path, "-") == 0 ) {
+	d->fd = sa_stream_direction == SA_STREAM_RECORD ? 0 : 1;
+    } else if ( strncmp(path, "fd:", 3) == 0 ) {
+	d->fd = atoi(path + 3);
+    } else {
+	if ( sa_stream_direction == SA_STREAM_RECORD )
+	    d->fd = open(path, O_RDONLY);
+	else
+	    d->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if ( d->fd < 0 ) {
+	    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	    free(d->stage);
+	    free(d);
+	    return 0;
+	}
+	d->close_fd = 1;
+    }
+
+    struct stat st;
+    if ( fstat(d->fd, &st) == 0 ) {
+#ifdef F_SETPIPE_SZ
+	if ( S_ISFIFO(st.st_mode) )
+	    fcntl(d->fd, F_SETPIPE_SZ, SA_RAW_PIPE_SIZE);	// best effort
+#endif
+#if defined(POSIX_FADV_SEQUENTIAL)
+	if ( S_ISREG(st.st_mode) && sa_stream_direction == SA_STREAM_RECORD )
+	    posix_fadvise(d->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    sa->backend_handle = d;
+    sa->backend_framesize = sa->channels * sa->samplesize;
+
+    return 1;
+}
+
+
+const struct simpleaudio_backend simpleaudio_backend_raw = {
+    sa_raw_open_stream,
+    sa_raw_read,
+    sa_raw_write,
+    sa_raw_close,
+    NULL /* map */,
+    sa_raw_set_nonblock,
+    sa_raw_poll_descriptors,
+    sa_raw_poll_ready,
+};
@@ -0,0 +1,312 @@
+/*
+ * simpleaudio-wav.c
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "simpleaudio.h"
+#include "simpleaudio_internal.h"
+
+
+/*
+ * uncompressed file writer backend for simpleaudio (playback only)
+ *
+ * backend_device is the path of a ".wav" file (16-bit PCM or 32-bit float,
+ * per the stream's sa_format) or a headerless ".raw" file.  Samples are
+ * gathered into a big aligned buffer and written out in large blocks; the
+ * WAV header is written up front with "unknown" lengths, and patched with
+ * the real ones at close (left as is if the output cannot seek, e.g. a
+ * pipe).  The RIFF lengths are 32-bit, so past 4 GB of samples they are
+ * left at their maximum, with a warning at close.
+ *
+ * Opening fails without any message for anything else (other file types,
+ * a big-endian host) or if the file cannot be created, so that callers can
+ * quietly fall back to the sndfile backend (which reports any error).
+ */
+
+#define SA_WAV_BUF_SIZE		(1024*1024)
+#define SA_WAV_BUF_ALIGN	4096
+#define SA_WAV_HEADER_SIZE	44	// 16-bit PCM
+#define SA_WAV_FLOAT_HEADER_SIZE 68	// float: fmt, fact and JUNK chunks
+#define SA_WAV_HEADER_MAX_SIZE	68
+
+struct wav_data {
+    char		*path;
+    int			fd;
+    int			is_raw;
+    char		*buf;
+    size_t		fill;
+    uint64_t		data_len;
+    int			failed;		// a write failed; so do all later ones
+    int			drained;
+};
+
+
+static void
+put_le16( unsigned char *p, unsigned int v )
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void
+put_le32( unsigned char *p, uint32_t v )
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * The header: for 16-bit PCM the canonical 44 bytes.  Float (format tag 3)
+ * takes an 18-byte fmt chunk and a fact chunk (the frame count), as the
+ * WAVE spec has it for non-PCM formats, then a 2-byte JUNK chunk to keep
+ * the samples 4-byte aligned for the mmap reader.  Returns its size.
+ */
+static size_t
+sa_wav_header( simpleaudio *sa, unsigned char *h, uint64_t data_len )
+{
+    int is_float = sa->format == SA_SAMPLE_FORMAT_FLOAT;
+    size_t size = is_float ? SA_WAV_FLOAT_HEADER_SIZE : SA_WAV_HEADER_SIZE;
+    uint32_t len32 = data_len > 0xFFFFFFFFU - (size-8) ? 0xFFFFFFFFU - (size-8)
+							: data_len;
+    uint64_t nframes = data_len / (sa->channels * sa->samplesize);
+
+    memcpy(h, "RIFF", 4);
+    put_le32(h+4, (size-8) + len32);
+    memcpy(h+8, "WAVEfmt ", 8);
+    put_le32(h+16, is_float ? 18 : 16);
+    put_le16(h+20, is_float ? 3 : 1);
+    put_le16(h+22, sa->channels);
+    put_le32(h+24, sa->rate);
+    put_le32(h+28, sa->rate * sa->channels * sa->samplesize);
+    put_le16(h+32, sa->channels * sa->samplesize);
+    put_le16(h+34, sa->samplesize * 8);
+    unsigned char *p = h+36;
+    if ( is_float ) {
+	put_le16(p, 0);		// cbSize
+	memcpy(p+2, "fact", 4);
+	put_le32(p+6, 4);
+	put_le32(p+10, nframes > 0xFFFFFFFFU ? 0xFFFFFFFFU : nframes);
+	memcpy(p+14, "JUNK", 4);
+	put_le32(p+18, 2);
+	put_le16(p+22, 0);
+	p += 24;
+    }
+    memcpy(p, "data", 4);
+    put_le32(p+4, len32);
+    return size;
+}
+
+static int
+sa_wav_write_full( int fd, const char *buf, size_t nbytes )
+{
+    while ( nbytes ) {
+	ssize_t n = write(fd, buf, nbytes);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("write");
+	    return -1;
+	}
+	buf += n;
+	nbytes -= n;
+    }
+    return 0;
+}
+
+static int
+sa_wav_flush( struct wav_data *d )
+{
+    if ( d->fill && sa_wav_write_full(d->fd, d->buf, d->fill) < 0 )
+	return -1;
+    d->fill = 0;
+    return 0;
+}
+
+
+static ssize_t
+sa_wav_read( simpleaudio *sa, void *buf, size_t nframes )
+{
+    return -1;
+}
+
+static ssize_t
+sa_wav_write( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct wav_data *d = sa->backend_handle;
+    const char *p = buf;
+    size_t nbytes = nframes * sa->backend_framesize;
+
+    if ( d->failed )
+	return -1;
+    d->data_len += nbytes;
+
+    // top up (and flush) a partly filled buffer first
+    if ( d->fill ) {
+	size_t n = SA_WAV_BUF_SIZE - d->fill;
+	if ( n > nbytes )
+	    n = nbytes;
+	memcpy(d->buf + d->fill, p, n);
+	d->fill += n;
+	p += n;
+	nbytes -= n;
+	if ( d->fill < SA_WAV_BUF_SIZE )
+	    return nframes;
+	if ( sa_wav_flush(d) < 0 )
+	    goto failed;
+    }
+
+    // whole buffers' worth go straight out, the tail is kept for later
+    size_t direct = nbytes - nbytes % SA_WAV_BUF_SIZE;
+    if ( direct && sa_wav_write_full(d->fd, p, direct) < 0 )
+	goto failed;
+    memcpy(d->buf, p + direct, nbytes - direct);
+    d->fill = nbytes - direct;
+
+    return nframes;
+
+failed:
+    d->failed = 1;
+    return -1;
+}
+
+static int
+sa_wav_drain( simpleaudio *sa )
+{
+    struct wav_data *d = sa->backend_handle;
+
+    if ( d->drained )
+	return d->failed ? -1 : 0;
+    d->drained = 1;
+    if ( d->failed )
+	return -1;
+
+    if ( sa_wav_flush(d) < 0 )
+	d->failed = 1;
+    else if ( !d->is_raw ) {
+	unsigned char h[SA_WAV_HEADER_MAX_SIZE];
+	size_t hsize = sa_wav_header(sa, h, d->data_len);
+	ssize_t n = pwrite(d->fd, h, hsize, 0);
+	if ( n < 0 && errno != ESPIPE ) {
+	    perror("pwrite");
+	    d->failed = 1;
+	} else if ( n >= 0 && n != hsize ) {
+	    fprintf(stderr, "%s: short header write\n", d->path);
+	    d->failed = 1;
+	}
+	if ( d->data_len > 0xFFFFFFFFU - (hsize-8) )
+	    fprintf(stderr, "W: %s: more than 4 GB of samples, too long for"
+		    " a WAV file's lengths (readers will stop short of the end;"
+		    " use a .raw file)\n", d->path);
+    }
+    return d->failed ? -1 : 0;
+}
+
+static void
+sa_wav_close( simpleaudio *sa )
+{
+    struct wav_data *d = sa->backend_handle;
+
+    sa_wav_drain(sa);
+    if ( close(d->fd) < 0 )
+	perror("close");
+    free(d->path);
+    free(d->buf);
+    free(d);
+}
+
+static int
+sa_wav_open_stream(
+		simpleaudio *sa,
+		const char *backend_device,
+		sa_direction_t sa_stream_direction,
+		sa_format_t sa_format,
+		unsigned int rate, unsigned int channels,
+		char *app_name, char *stream_name )
+{
+    const unsigned short one = 1;
+    if ( *(const unsigned char *)&one != 1 )
+	return 0;	// the file data is little-endian
+    if ( sa_stream_direction != SA_STREAM_PLAYBACK || !backend_device )
+	return 0;
+
+    const char *path = backend_device;
+    const char *ext = strrchr(path, '.');
+    if ( !ext )
+	return 0;
+    int is_raw;
+    if ( strcasecmp(ext, ".wav") == 0 )
+	is_raw = 0;
+    else if ( strcasecmp(ext, ".raw") == 0 )
+	is_raw = 1;
+    else
+	return 0;
+
+    struct wav_data *d = calloc(1, sizeof(struct wav_data));
+    if ( !d )
+	return 0;
+    d->is_raw = is_raw;
+    if ( posix_memalign((void **)&d->buf, SA_WAV_BUF_ALIGN, SA_WAV_BUF_SIZE) ) {
+	free(d);
+	return 0;
+    }
+
+    d->path = strdup(path);
+    d->fd = d->path ? open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666) : -1;
+    if ( d->fd < 0 ) {
+	free(d->path);
+	free(d->buf);
+	free(d);
+	return 0;
+    }
+
+    sa->backend_handle = d;
+    sa->backend_framesize = sa->channels * sa->samplesize;
+
+    // lengths unknown until close (and for good, if we cannot seek back)
+    if ( !is_raw )
+	d->fill = sa_wav_header(sa, (unsigned char *)d->buf, UINT64_MAX);
+
+    return 1;
+}
+
+
+const struct simpleaudio_backend simpleaudio_backend_wav = {
+    sa_wav_open_stream,
+    sa_wav_read,
+    sa_wav_write,
+    sa_wav_close,
+    NULL /* map */,
+    NULL /* set_nonblock */,
+    NULL /* poll_descriptors */,
+    NULL /* poll_ready */,
+    sa_wav_drain,
+};
@@ -21,6 +21,8 @@
 #include "simpleaudio_internal.h"
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <stdio.h>
 
@@ -74,6 +76,18 @@ simpleaudio_open_stream(
 	    break;
 #endif
 
+	case SA_BACKEND_RAW:
+	    sa->backend = &simpleaudio_backend_raw;
+	    break;
+
+	case SA_BACKEND_MMAP:
+	    sa->backend = &simpleaudio_backend_mmap;
+	    break;
+
+	case SA_BACKEND_WAV:
+	    sa->backend = &simpleaudio_backend_wav;
+	    break;
+
 #if USE_BENCHMARKS
 	case SA_BACKEND_BENCHMARK:
 	    sa->backend = &simpleaudio_backend_benchmark;
@@ -127,6 +141,14 @@ simpleaudio_open_stream(
 	return 0;
     }
 
+    if ( ok && sa_stream_direction == SA_STREAM_PLAYBACK ) {
+	sa->tone_generator = simpleaudio_tone_generator_new_default();
+	if ( !sa->tone_generator ) {
+	    simpleaudio_close(sa);
+	    return NULL;
+	}
+    }
+
     if ( ok ) {
 	assert( sa->backend_framesize == sa->channels * sa->samplesize );
 	return sa;
@@ -167,12 +189,290 @@ simpleaudio_get_samplesize( simpleaudio *sa )
     return sa->samplesize;
 }
 
+unsigned long
+simpleaudio_get_underruns( simpleaudio *sa )
+{
+    return sa->underruns;
+}
+
+unsigned int simpleaudio_latency_us = 100000;
+
+void
+simpleaudio_set_latency( unsigned int latency_us )
+{
+    simpleaudio_latency_us = latency_us;
+}
+
 void
 simpleaudio_set_rxnoise( simpleaudio *sa, float rxnoise_factor )
 {
     sa->rxnoise = rxnoise_factor;
 }
 
+/*
+ * Sample format conversion
+ *
+ * Every format converts to and from FLOAT, and the integer formats to and
+ * from each other by way of left-justified 32-bit values.
+ *
+ * The S16, S32 and U8 <-> FLOAT converters run in whole blocks of
+ * SA_CONV_BLOCK samples (then the rest), which the compiler vectorizes
+ * even at -O2, the same as the tone generator's blocks.  For that, they
+ * round by adding and subtracting 1.5 * 2^23 (round half to even, the same
+ * as lrintf()) and clamp in the integer domain, as a float compare would
+ * keep them from vectorizing.  The packed S24 and the (double precision)
+ * FLOAT -> S32 conversions are plain loops.
+ */
+
+#define SA_CONV_BLOCK	16
+
+static const struct {
+    const char		*name;
+    sa_format_t		format;
+    unsigned int	samplesize;
+} sa_formats[] = {
+    { "s16",	SA_SAMPLE_FORMAT_S16,	2 },
+    { "float",	SA_SAMPLE_FORMAT_FLOAT,	4 },
+    { "s24",	SA_SAMPLE_FORMAT_S24,	3 },
+    { "s32",	SA_SAMPLE_FORMAT_S32,	4 },
+    { "u8",	SA_SAMPLE_FORMAT_U8,	1 },
+};
+#define SA_NFORMATS	(sizeof(sa_formats) / sizeof(sa_formats[0]))
+
+// floats from 2^23 to 2^24 (and doubles from 2^52 to 2^53) are integers
+#define SA_ROUND_F	12582912.0f
+#define SA_ROUND_D	6755399441055744.0
+
+unsigned int
+sa_format_samplesize( sa_format_t format )
+{
+    unsigned int i;
+    for ( i=0; i<SA_NFORMATS; i++ )
+	if ( sa_formats[i].format == format )
+	    return sa_formats[i].samplesize;
+    return 0;
+}
+
+const char *
+sa_device_format_prefix( const char *device, sa_format_t *formatp )
+{
+    unsigned int i;
+    for ( i=0; i<SA_NFORMATS; i++ ) {
+	size_t len = strlen(sa_formats[i].name);
+	if ( strncmp(device, sa_formats[i].name, len) == 0
+		&& device[len] == ':' ) {
+	    *formatp = sa_formats[i].format;
+	    return device + len + 1;
+	}
+    }
+    return device;
+}
+
+static inline void
+sa_s16_to_float( float *restrict out, const int16_t *restrict in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ )
+	out[i] = in[i] * (1.0f/32768.0f);
+}
+
+static inline void
+sa_s32_to_float( float *restrict out, const int32_t *restrict in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ )
+	out[i] = in[i] * (1.0f/2147483648.0f);
+}
+
+static inline void
+sa_u8_to_float( float *restrict out, const uint8_t *restrict in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ )
+	out[i] = (in[i] - 128) * (1.0f/128.0f);
+}
+
+// (for in-range samples: beyond about 2^16 full scale the int32 overflows)
+static inline void
+sa_float_to_s16( int16_t *restrict out, const float *restrict in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+	int32_t v = (in[i] * 32767.0f + SA_ROUND_F) - SA_ROUND_F;
+	v = v < 32767 ? v : 32767;
+	v = v > -32768 ? v : -32768;
+	out[i] = v;
+    }
+}
+
+static inline void
+sa_float_to_u8( uint8_t *restrict out, const float *restrict in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+	int32_t v = (in[i] * 127.0f + SA_ROUND_F) - SA_ROUND_F;
+	v = v < 127 ? v : 127;
+	v = v > -128 ? v : -128;
+	out[i] = v + 128;
+    }
+}
+
+/* fn() over whole SA_CONV_BLOCKs, then over the rest */
+#define SA_CONV_BLOCKS(fn, out, in, n)					\
+    do {								\
+	size_t i_ = 0;							\
+	for ( ; i_+SA_CONV_BLOCK<=(n); i_+=SA_CONV_BLOCK )		\
+	    fn((out)+i_, (in)+i_, SA_CONV_BLOCK);			\
+	fn((out)+i_, (in)+i_, (n)-i_);					\
+    } while (0)
+
+static inline int32_t
+sa_s24_get( const uint8_t *p )
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16
+			| (uint32_t)p[2] << 24) >> 8;
+}
+
+static inline void
+sa_s24_put( uint8_t *p, int32_t v )
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+}
+
+static void
+sa_to_float( float *out, const void *in, sa_format_t in_format, size_t n )
+{
+    size_t i;
+    switch ( in_format ) {
+	case SA_SAMPLE_FORMAT_S16:
+	    SA_CONV_BLOCKS(sa_s16_to_float, out, (const int16_t *)in, n);
+	    break;
+	case SA_SAMPLE_FORMAT_S32:
+	    SA_CONV_BLOCKS(sa_s32_to_float, out, (const int32_t *)in, n);
+	    break;
+	case SA_SAMPLE_FORMAT_U8:
+	    SA_CONV_BLOCKS(sa_u8_to_float, out, (const uint8_t *)in, n);
+	    break;
+	case SA_SAMPLE_FORMAT_S24:
+	    for ( i=0; i<n; i++ )
+		out[i] = sa_s24_get((const uint8_t *)in + 3*i)
+			    * (1.0f/8388608.0f);
+	    break;
+	default:
+	    assert(0);
+    }
+}
+
+static void
+sa_from_float( void *out, sa_format_t out_format, const float *in, size_t n )
+{
+    size_t i;
+    switch ( out_format ) {
+	case SA_SAMPLE_FORMAT_S16:
+	    SA_CONV_BLOCKS(sa_float_to_s16, (int16_t *)out, in, n);
+	    break;
+	case SA_SAMPLE_FORMAT_U8:
+	    SA_CONV_BLOCKS(sa_float_to_u8, (uint8_t *)out, in, n);
+	    break;
+	case SA_SAMPLE_FORMAT_S24:
+	    for ( i=0; i<n; i++ ) {
+		double f = in[i] * 8388607.0;
+		f = f > 8388607.0 ? 8388607.0 : f < -8388608.0 ? -8388608.0 : f;
+		sa_s24_put((uint8_t *)out + 3*i,
+				(f + SA_ROUND_D) - SA_ROUND_D);
+	    }
+	    break;
+	case SA_SAMPLE_FORMAT_S32:
+	    for ( i=0; i<n; i++ ) {
+		double f = in[i] * 2147483647.0;
+		f = f > 2147483647.0 ? 2147483647.0 :
+		    f < -2147483648.0 ? -2147483648.0 : f;
+		((int32_t *)out)[i] = (f + SA_ROUND_D) - SA_ROUND_D;
+	    }
+	    break;
+	default:
+	    assert(0);
+    }
+}
+
+static void
+sa_to_s32( int32_t *out, const void *in, sa_format_t in_format, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+	switch ( in_format ) {
+	    case SA_SAMPLE_FORMAT_S16:
+		out[i] = (uint32_t)((const int16_t *)in)[i] << 16;
+		break;
+	    case SA_SAMPLE_FORMAT_S24:
+		out[i] = (uint32_t)sa_s24_get((const uint8_t *)in + 3*i) << 8;
+		break;
+	    case SA_SAMPLE_FORMAT_S32:
+		out[i] = ((const int32_t *)in)[i];
+		break;
+	    case SA_SAMPLE_FORMAT_U8:
+		out[i] = (uint32_t)(((const uint8_t *)in)[i] ^ 0x80) << 24;
+		break;
+	    default:
+		assert(0);
+	}
+    }
+}
+
+static void
+sa_from_s32( void *out, sa_format_t out_format, const int32_t *in, size_t n )
+{
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+	switch ( out_format ) {
+	    case SA_SAMPLE_FORMAT_S16:
+		((int16_t *)out)[i] = in[i] >> 16;
+		break;
+	    case SA_SAMPLE_FORMAT_S24:
+		sa_s24_put((uint8_t *)out + 3*i, in[i] >> 8);
+		break;
+	    case SA_SAMPLE_FORMAT_S32:
+		((int32_t *)out)[i] = in[i];
+		break;
+	    case SA_SAMPLE_FORMAT_U8:
+		((uint8_t *)out)[i] = (uint32_t)in[i] >> 24 ^ 0x80;
+		break;
+	    default:
+		assert(0);
+	}
+    }
+}
+
+void
+sa_convert_samples( void *out, sa_format_t out_format,
+		const void *in, sa_format_t in_format, size_t nsamples )
+{
+    if ( out_format == in_format ) {
+	memcpy(out, in, nsamples * sa_format_samplesize(in_format));
+    } else if ( out_format == SA_SAMPLE_FORMAT_FLOAT ) {
+	sa_to_float(out, in, in_format, nsamples);
+    } else if ( in_format == SA_SAMPLE_FORMAT_FLOAT ) {
+	sa_from_float(out, out_format, in, nsamples);
+    } else {
+	// integer to integer, a cache-sized chunk at a time
+	const char *inp = in;
+	char *outp = out;
+	size_t in_size = sa_format_samplesize(in_format);
+	size_t out_size = sa_format_samplesize(out_format);
+	while ( nsamples ) {
+	    int32_t tmp[1024];
+	    size_t n = nsamples < 1024 ? nsamples : 1024;
+	    sa_to_s32(tmp, inp, in_format, n);
+	    sa_from_s32(outp, out_format, tmp, n);
+	    inp += n * in_size;
+	    outp += n * out_size;
+	    nsamples -= n;
+	}
+    }
+}
+
 ssize_t
 simpleaudio_read( simpleaudio *sa, void *buf, size_t nframes )
 {
@@ -185,9 +485,56 @@ simpleaudio_write( simpleaudio *sa, void *buf, size_t nframes )
     return sa->backend->simpleaudio_write(sa, buf, nframes);
 }
 
+const void *
+simpleaudio_map( simpleaudio *sa, size_t *nframesp )
+{
+    if ( !sa->backend->simpleaudio_map )
+	return NULL;
+    return sa->backend->simpleaudio_map(sa, nframesp);
+}
+
+int
+simpleaudio_set_nonblock( simpleaudio *sa, int nonblock )
+{
+    if ( !sa->backend->simpleaudio_set_nonblock )
+	return -1;
+    if ( sa->backend->simpleaudio_set_nonblock(sa, nonblock) < 0 )
+	return -1;
+    sa->nonblock = nonblock;
+    return 0;
+}
+
+int
+simpleaudio_poll_descriptors( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int space )
+{
+    if ( !sa->backend->simpleaudio_poll_descriptors )
+	return 0;
+    return sa->backend->simpleaudio_poll_descriptors(sa, pfds, space);
+}
+
+int
+simpleaudio_poll_ready( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int nfds )
+{
+    if ( !sa->backend->simpleaudio_poll_ready )
+	return 1;
+    return sa->backend->simpleaudio_poll_ready(sa, pfds, nfds);
+}
+
+int
+simpleaudio_drain( simpleaudio *sa )
+{
+    if ( !sa->backend->simpleaudio_drain )
+	return 0;
+    return sa->backend->simpleaudio_drain(sa);
+}
+
 void
 simpleaudio_close( simpleaudio *sa )
 {
     sa->backend->simpleaudio_close(sa);
+    if ( sa->tone_generator )
+	sa_tone_generator_destroy(sa->tone_generator);
     free(sa);
 }
@@ -39,6 +39,9 @@ typedef enum {
 	SA_BACKEND_ALSA,
 	SA_BACKEND_PULSEAUDIO,
 	SA_BACKEND_SNDIO,
+	SA_BACKEND_RAW,
+	SA_BACKEND_MMAP,
+	SA_BACKEND_WAV,
 } sa_backend_t;
 
 /* sa_stream_direction */
@@ -51,6 +54,10 @@ typedef enum {
 typedef enum {
 	SA_SAMPLE_FORMAT_S16,
 	SA_SAMPLE_FORMAT_FLOAT,
+	/* wire and file formats only (see sa_convert_samples()) */
+	SA_SAMPLE_FORMAT_S24,		// packed 3-byte little-endian
+	SA_SAMPLE_FORMAT_S32,
+	SA_SAMPLE_FORMAT_U8,
 } sa_format_t;
 
 simpleaudio *
@@ -77,30 +84,138 @@ simpleaudio_get_format( simpleaudio *sa );
 unsigned int
 simpleaudio_get_samplesize( simpleaudio *sa );
 
+/* playback underruns (xruns) so far, for backends that can tell (ALSA) */
+unsigned long
+simpleaudio_get_underruns( simpleaudio *sa );
+
 void
 simpleaudio_set_rxnoise( simpleaudio *sa, float rxnoise_factor );
 
+/*
+ * The buffering latency to ask of system audio streams opened from now on
+ * (where the backend lets us choose; e.g. ALSA), in microseconds.
+ */
+void
+simpleaudio_set_latency( unsigned int latency_us );
+
 ssize_t
 simpleaudio_read( simpleaudio *sa, void *buf, size_t nframes );
 
 ssize_t
 simpleaudio_write( simpleaudio *sa, void *buf, size_t nframes );
 
+/*
+ * Non-blocking, readiness-driven I/O, so that one thread can service any
+ * number of streams.  After simpleaudio_set_nonblock(sa, 1),
+ * simpleaudio_read() and simpleaudio_write() move only as many frames as
+ * they can without waiting (possibly fewer than asked), or return -1 with
+ * errno EAGAIN if that is none.  To wait, poll() on the stream's
+ * descriptors; simpleaudio_poll_ready() then tells whether the next read
+ * or write will make progress (or report end of input or an error).
+ *
+ * simpleaudio_set_nonblock() returns 0, or -1 if the backend cannot do
+ * non-blocking I/O (only the raw and ALSA backends can).
+ */
+struct pollfd;
+
+int
+simpleaudio_set_nonblock( simpleaudio *sa, int nonblock );
+
+/* fill in up to space descriptors and return how many; with pfds NULL,
+ * just return how many there are */
+int
+simpleaudio_poll_descriptors( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int space );
+
+/* after poll(), on the descriptors filled in above */
+int
+simpleaudio_poll_ready( simpleaudio *sa, struct pollfd *pfds,
+	unsigned int nfds );
+
+/*
+ * For a record stream whose whole input is in memory already (the mmap
+ * backend), return a pointer to all of its frames in the stream's own
+ * sa_format, and set *nframesp.  Returns NULL if the backend cannot do
+ * that; use simpleaudio_read() instead.  The frames stay valid until
+ * simpleaudio_close().
+ */
+const void *
+simpleaudio_map( simpleaudio *sa, size_t *nframesp );
+
+/*
+ * For a playback stream, push out whatever the backend still holds (and
+ * finish the file, e.g. fill in a WAV header's lengths).  Returns 0, or -1
+ * if that or any earlier write failed -- simpleaudio_close() cannot tell.
+ */
+int
+simpleaudio_drain( simpleaudio *sa );
+
 void
 simpleaudio_close( simpleaudio *sa );
 
 
 /*
  * simpleaudio tone generator
+ *
+ * Each playback stream has its own tone generator (phase, amplitude and
+ * bit waveform cache), made at simpleaudio_open_stream() with the sin
+ * table size and amplitude last given to simpleaudio_tone_init().  Call
+ * simpleaudio_tone_init() only while no playback streams are open.
  */
 
 void
-simpleaudio_tone_reset();
+simpleaudio_tone_reset( simpleaudio *sa_out );
 
 void
 simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur);
 
+/* synthesize the tone into buf (in sa_out's format) instead of writing it */
+void
+simpleaudio_tone_fill(simpleaudio *sa_out, void *buf,
+		float tone_freq, size_t nsamples_dur);
+
 void
 simpleaudio_tone_init( unsigned int new_sin_table_len, float mag );
 
+/* the playback stream's tone generator (see below) */
+struct sa_tone_generator *
+simpleaudio_get_tone_generator( simpleaudio *sa_out );
+
+
+/*
+ * Tone generators may also be made and used directly.  A sa_sine_table
+ * is read-only once made, and may be shared by any number of tone
+ * generators in any threads (it must outlive them).  A tone generator
+ * holds its own phase, amplitude and bit waveform cache, so needs no
+ * locking as long as one thread at a time uses it.
+ */
+
+typedef struct sa_sine_table sa_sine_table;
+typedef struct sa_tone_generator sa_tone_generator;
+
+sa_sine_table *
+sa_sine_table_new( unsigned int len );
+
+void
+sa_sine_table_destroy( sa_sine_table *table );
+
+/* table NULL: compute each sample with sinf() */
+sa_tone_generator *
+sa_tone_generator_new( const sa_sine_table *table, float mag );
+
+void
+sa_tone_generator_destroy( sa_tone_generator *tg );
+
+void
+sa_tone_generator_reset( sa_tone_generator *tg );
+
+/* how many times it has allocated memory (for its waveform cache) */
+unsigned long
+sa_tone_generator_get_nallocs( sa_tone_generator *tg );
+
+/* synthesize a tone in sa_out's format and rate into buf */
+void
+sa_tone_generator_fill( sa_tone_generator *tg, simpleaudio *sa_out,
+		void *buf, float tone_freq, size_t nsamples_dur );
+
 #endif
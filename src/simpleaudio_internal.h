@@ -36,6 +36,9 @@ struct simpleaudio {
 	unsigned int	samplesize;
 	unsigned int	backend_framesize;
 	float		rxnoise;		// only for the sndfile backend
+	sa_tone_generator *tone_generator;	// playback streams only
+	unsigned long	underruns;		// see simpleaudio_get_underruns()
+	int		nonblock;		// see simpleaudio_set_nonblock()
 };
 
 struct simpleaudio_backend {
@@ -57,12 +60,57 @@ struct simpleaudio_backend {
 
 	void
 	(*simpleaudio_close)( simpleaudio *sa );
+
+	/* optional: see simpleaudio_map() */
+	const void *
+	(*simpleaudio_map)( simpleaudio *sa, size_t *nframesp );
+
+	/* optional: see simpleaudio_set_nonblock() */
+	int
+	(*simpleaudio_set_nonblock)( simpleaudio *sa, int nonblock );
+
+	int
+	(*simpleaudio_poll_descriptors)( simpleaudio *sa, struct pollfd *pfds,
+		unsigned int space );
+
+	int
+	(*simpleaudio_poll_ready)( simpleaudio *sa, struct pollfd *pfds,
+		unsigned int nfds );
+
+	/* optional: see simpleaudio_drain() */
+	int
+	(*simpleaudio_drain)( simpleaudio *sa );
 };
 
+extern unsigned int simpleaudio_latency_us;	// simpleaudio_set_latency()
+
+/*
+ * Sample format conversion, for backends whose wire or file format is not
+ * the stream's (see simpleaudio.c).  Convert straight into the caller's
+ * buffer, so that each sample is touched only once.
+ */
+unsigned int
+sa_format_samplesize( sa_format_t format );
+
+void
+sa_convert_samples( void *out, sa_format_t out_format,
+		const void *in, sa_format_t in_format, size_t nsamples );
+
+/* strip a "{s16|s24|s32|u8|float}:" prefix off a device string */
+const char *
+sa_device_format_prefix( const char *device, sa_format_t *formatp );
+
+/* a tone generator with the simpleaudio_tone_init() settings */
+sa_tone_generator *
+simpleaudio_tone_generator_new_default();
+
 extern const struct simpleaudio_backend simpleaudio_backend_benchmark;
 extern const struct simpleaudio_backend simpleaudio_backend_sndfile;
 extern const struct simpleaudio_backend simpleaudio_backend_alsa;
 extern const struct simpleaudio_backend simpleaudio_backend_pulseaudio;
 extern const struct simpleaudio_backend simpleaudio_backend_sndio;
+extern const struct simpleaudio_backend simpleaudio_backend_raw;
+extern const struct simpleaudio_backend simpleaudio_backend_mmap;
+extern const struct simpleaudio_backend simpleaudio_backend_wav;
 
 #endif
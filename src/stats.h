@@ -0,0 +1,63 @@
+/*
+ * stats.h
+ *
+ * Copyright (C) 2011-2020 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Hot-path counters and timers for --stats.  A counter is bumped only if
+ * its stats struct pointer is non-NULL (i.e. --stats was requested for the
+ * stream), and in a build configured with --disable-stats all of these
+ * compile to nothing.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if USE_STATS
+
+#include <time.h>
+
+static inline unsigned long long
+stats_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+# define STATS_INC(sp, field)		do { if ( sp ) (sp)->field++; } while (0)
+# define STATS_ADD(sp, field, n)	do { if ( sp ) (sp)->field += (n); } while (0)
+# define STATS_SET(lvalue, value)	do { (lvalue) = (value); } while (0)
+/* time a block: STATS_TIME_BEGIN(sp, t); ... STATS_TIME_END(sp, field, t); */
+# define STATS_TIME_BEGIN(sp, t)	unsigned long long t = (sp) ? stats_now_ns() : 0
+# define STATS_TIME_END(sp, field, t)	STATS_ADD(sp, field, stats_now_ns() - (t))
+
+#else
+
+# define STATS_INC(sp, field)		do { } while (0)
+# define STATS_ADD(sp, field, n)	do { } while (0)
+# define STATS_SET(lvalue, value)	do { } while (0)
+# define STATS_TIME_BEGIN(sp, t)	do { } while (0)
+# define STATS_TIME_END(sp, field, t)	do { } while (0)
+
+#endif /* USE_STATS */
+
+#endif